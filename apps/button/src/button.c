@@ -37,6 +37,9 @@ void btn_press(struct device *gpiob,
 {
 	led = !led;
 	gpio_pin_write(gpiob, LED_PIN, !led); /* Update GPIO */
+
+	/* Send it now: no need to wait for the next scan */
+	knot_data_notify(0);
 }
 
 int changed_led(int id)
@@ -86,6 +86,8 @@ void loop(void)
 			led = true;
 			gpio_pin_write(gpio_led, LED_PIN, !led);
 			counter++;
+			knot_data_notify(0);
+			knot_data_notify(1);
 		}
 	}
 
@@ -94,5 +96,6 @@ void loop(void)
 	    current_time - last_toggle_time > 1000) {
 		led = false;
 		gpio_pin_write(gpio_led, LED_PIN, !led);
+		knot_data_notify(0);
 	}
 }
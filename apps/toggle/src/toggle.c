@@ -38,20 +38,17 @@ int write_led(int id)
 	return KNOT_CALLBACK_SUCCESS;
 }
 
+/* KNoT config: checked at build time and kept in flash */
+KNOT_DATA_DEFINE(0, "LED", KNOT_TYPE_ID_SWITCH,
+		 KNOT_VALUE_TYPE_BOOL, KNOT_UNIT_NOT_APPLICABLE,
+		 toggle, write_led, NULL,
+		 KNOT_EVT_FLAG_CHANGE, 0);
+
 void setup(void)
 {
 	/* Peripherals control */
 	gpio_led = device_get_binding(TOGGLE_PORT);
 	gpio_pin_configure(gpio_led, TOGGLE_PIN, GPIO_DIR_OUT);
-
-	/* KNoT config */
-	knot_data_register(0, "LED", KNOT_TYPE_ID_SWITCH,
-			   KNOT_VALUE_TYPE_BOOL, KNOT_UNIT_NOT_APPLICABLE,
-			   &toggle, sizeof(toggle),
-			   write_led, NULL);
-
-	knot_data_config(0, KNOT_EVT_FLAG_CHANGE, NULL);
-
 }
 
 void loop(void)
@@ -0,0 +1,727 @@
+/* coap6.c - KNoT Application Client */
+
+/*
+ * Copyright (c) 2019, CESAR. All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * CoAP transport: KNoT messages are carried as the payload of CoAP
+ * messages over UDP. The thing exposes two resources:
+ *   /knot	 POST: message from the gateway
+ *   /knot/data GET + Observe: telemetry (data pushed) notifications
+ * Messages to the gateway are POST requests to /knot, or notifications
+ * to the observer registered at /knot/data when they are telemetry.
+ * Telemetry of items sent on value change is confirmable, while items
+ * only sent periodically use non-confirmable messages: the next sample
+ * replaces a lost one. Confirmable messages are sent again until acked.
+ */
+
+#include <zephyr.h>
+#include <logging/log.h>
+#include <errno.h>
+#include <string.h>
+
+#include <net/socket.h>
+#include <net/buf.h>
+#include <net/coap.h>
+
+#include "net.h"
+#include "pdu.h"
+#include "coap6.h"
+
+LOG_MODULE_DECLARE(knot, CONFIG_KNOT_LOG_LEVEL);
+
+#define PEER_COAP_PORT		5683
+
+#define COAP_VERSION		1
+#define COAP_TOKEN_LEN		8
+#define COAP_HDR_MAX		PDU_HEADROOM	/* Header, token and options */
+#define COAP_PDU_LEN		CONFIG_KNOT_PDU_SIZE
+#define COAP_BUF_LEN		(COAP_HDR_MAX + COAP_PDU_LEN)
+#define COAP_MAX_OPTIONS	8
+#define COAP_REPLIES		4	/* Confirmable messages remembered */
+#define COAP_OBSERVE_MASK	0xFFFFFF
+
+#define KNOT_PATH		"knot"
+#define DATA_PATH		"data"
+
+struct coap_slot {
+	u8_t buf[COAP_BUF_LEN];
+	u16_t len;
+	u16_t id;		/* Message ID waiting ack */
+	s64_t deadline;		/* Uptime to send again */
+	s32_t timeout;		/* Doubles at each retry */
+	u8_t retries;
+	bool notify;		/* Observe notification */
+	bool used;
+};
+
+/* Reply to a confirmable message: sent again if it is received again */
+struct coap_reply {
+	u8_t buf[COAP_HDR_MAX];
+	u8_t len;
+	u16_t id;		/* Message ID replied */
+};
+
+static struct {
+	u8_t token[COAP_TOKEN_LEN];
+	u8_t tkl;
+	u32_t seq;		/* Observe option of last notification */
+	bool active;
+} observer;
+
+static struct zsock_pollfd fds;
+static net_recv_t recv_cb;
+static net_close_t close_cb;
+static int socket = -1;
+
+static struct coap_slot slots[CONFIG_KNOT_COAP_TX_SLOTS];
+static struct coap_reply replies[COAP_REPLIES];
+static u8_t reply_next;		/* Oldest reply: replaced next */
+static K_MUTEX_DEFINE(lock);
+
+/* Off the stacks: sent while locked */
+static u8_t tx_buf[COAP_BUF_LEN];
+
+static int socket_send(const u8_t *buf, size_t len)
+{
+	ssize_t out_len;
+
+	out_len = zsock_send(socket, buf, len, 0);
+	if (out_len < 0)
+		return -errno;
+
+	return out_len;
+}
+
+/* Zephyr generators keep static state: callers may be any thread */
+static u16_t next_id(void)
+{
+	u16_t id;
+
+	k_mutex_lock(&lock, K_FOREVER);
+	id = coap_next_id();
+	k_mutex_unlock(&lock);
+
+	return id;
+}
+
+static void next_token(u8_t *token)
+{
+	k_mutex_lock(&lock, K_FOREVER);
+	memcpy(token, coap_next_token(), COAP_TOKEN_LEN);
+	k_mutex_unlock(&lock);
+}
+
+/* Send reply to a confirmable message and keep it for duplicates */
+static int reply_send(const struct coap_packet *cpkt)
+{
+	struct coap_reply *reply;
+
+	k_mutex_lock(&lock, K_FOREVER);
+
+	reply = &replies[reply_next];
+	reply_next = (reply_next + 1) % ARRAY_SIZE(replies);
+
+	memcpy(reply->buf, cpkt->data, cpkt->offset);
+	reply->len = cpkt->offset;
+	reply->id = coap_header_get_id(cpkt);
+
+	k_mutex_unlock(&lock);
+
+	return socket_send(cpkt->data, cpkt->offset);
+}
+
+/* Duplicate: send the same reply again. Return false if not replied */
+static bool reply_resend(u16_t id)
+{
+	bool found = false;
+	int i;
+
+	k_mutex_lock(&lock, K_FOREVER);
+
+	for (i = 0; i < ARRAY_SIZE(replies); i++) {
+		if (replies[i].len && replies[i].id == id) {
+			(void) socket_send(replies[i].buf, replies[i].len);
+			found = true;
+			break;
+		}
+	}
+
+	k_mutex_unlock(&lock);
+
+	return found;
+}
+
+static void slot_send(struct coap_slot *slot)
+{
+	(void) socket_send(slot->buf, slot->len);
+
+	slot->deadline = k_uptime_get() + slot->timeout;
+	slot->timeout <<= 1;
+}
+
+static struct coap_slot *slot_alloc(void)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(slots); i++) {
+		if (!slots[i].used)
+			return &slots[i];
+	}
+
+	return NULL;
+}
+
+/* Send message and keep it until acked if confirmable. Mutex is recursive */
+static int packet_send(const struct coap_packet *cpkt, bool notify)
+{
+	struct coap_slot *slot;
+
+	if (coap_header_get_type(cpkt) != COAP_TYPE_CON)
+		return socket_send(cpkt->data, cpkt->offset);
+
+	k_mutex_lock(&lock, K_FOREVER);
+
+	/* All slots waiting ack: net thread holds the PDU until one is free */
+	slot = slot_alloc();
+	if (!slot) {
+		k_mutex_unlock(&lock);
+		LOG_WRN("CoAP: No slot available");
+		return -ENOBUFS;
+	}
+
+	memcpy(slot->buf, cpkt->data, cpkt->offset);
+	slot->len = cpkt->offset;
+	slot->id = coap_header_get_id(cpkt);
+	slot->notify = notify;
+	slot->retries = 0;
+	/* Initial timeout randomized between ACK_TIMEOUT and 1.5 times it */
+	slot->timeout = CONFIG_KNOT_COAP_ACK_TIMEOUT + sys_rand32_get() %
+			(CONFIG_KNOT_COAP_ACK_TIMEOUT / 2 + 1);
+	slot->used = true;
+	slot_send(slot);
+
+	k_mutex_unlock(&lock);
+
+	return cpkt->offset;
+}
+
+static void ack_received(u16_t id, bool reset)
+{
+	struct coap_slot *slot;
+	int i;
+
+	k_mutex_lock(&lock, K_FOREVER);
+
+	for (i = 0; i < ARRAY_SIZE(slots); i++) {
+		slot = &slots[i];
+		if (!slot->used || slot->id != id)
+			continue;
+
+		slot->used = false;
+
+		/* Observer not interested anymore */
+		if (reset && slot->notify) {
+			LOG_INF("CoAP: Observer removed");
+			observer.active = false;
+		}
+		break;
+	}
+
+	k_mutex_unlock(&lock);
+}
+
+static int send_empty(u8_t type, u16_t id)
+{
+	struct coap_packet cpkt;
+	u8_t buf[COAP_HDR_MAX];
+	int rc;
+
+	rc = coap_packet_init(&cpkt, buf, sizeof(buf), COAP_VERSION, type,
+			      0, NULL, COAP_CODE_EMPTY, id);
+	if (rc < 0)
+		return rc;
+
+	/* Ack or reset of a confirmable message */
+	return reply_send(&cpkt);
+}
+
+/* Piggybacked response if request is confirmable */
+static int send_response(const struct coap_packet *req, u8_t code,
+			 bool observe)
+{
+	struct coap_packet cpkt;
+	u8_t buf[COAP_HDR_MAX];
+	u8_t token[COAP_TOKEN_LEN];
+	u8_t tkl;
+	u8_t type;
+	u16_t id;
+	int rc;
+
+	tkl = coap_header_get_token(req, token);
+	if (coap_header_get_type(req) == COAP_TYPE_CON) {
+		type = COAP_TYPE_ACK;
+		id = coap_header_get_id(req);
+	} else {
+		type = COAP_TYPE_NON_CON;
+		id = next_id();
+	}
+
+	rc = coap_packet_init(&cpkt, buf, sizeof(buf), COAP_VERSION, type,
+			      tkl, token, code, id);
+	if (rc < 0)
+		return rc;
+
+	if (observe) {
+		rc = coap_append_option_int(&cpkt, COAP_OPTION_OBSERVE,
+					    observer.seq);
+		if (rc < 0)
+			return rc;
+	}
+
+	if (type == COAP_TYPE_ACK)
+		return reply_send(&cpkt);
+
+	return socket_send(cpkt.data, cpkt.offset);
+}
+
+static int append_payload(struct coap_packet *cpkt, const u8_t *pdu,
+			  size_t len)
+{
+	int rc;
+
+	rc = coap_append_option_int(cpkt, COAP_OPTION_CONTENT_FORMAT,
+				    COAP_CONTENT_FORMAT_APP_OCTET_STREAM);
+	if (rc < 0)
+		return rc;
+
+	rc = coap_packet_append_payload_marker(cpkt);
+	if (rc < 0)
+		return rc;
+
+	return coap_packet_append_payload(cpkt, (u8_t *) pdu, len);
+}
+
+static int send_notification(const u8_t *pdu, size_t len, bool con)
+{
+	struct coap_packet cpkt;
+	int rc;
+
+	rc = coap_packet_init(&cpkt, tx_buf, sizeof(tx_buf), COAP_VERSION,
+			      con ? COAP_TYPE_CON : COAP_TYPE_NON_CON,
+			      observer.tkl, observer.token,
+			      COAP_RESPONSE_CODE_CONTENT, next_id());
+	if (rc < 0)
+		return rc;
+
+	observer.seq = (observer.seq + 1) & COAP_OBSERVE_MASK;
+	rc = coap_append_option_int(&cpkt, COAP_OPTION_OBSERVE, observer.seq);
+	if (rc < 0)
+		return rc;
+
+	rc = append_payload(&cpkt, pdu, len);
+	if (rc < 0)
+		return rc;
+
+	rc = packet_send(&cpkt, true);
+
+	return (rc < 0) ? rc : len;
+}
+
+static int send_request(const u8_t *pdu, size_t len, bool con)
+{
+	struct coap_packet cpkt;
+	u8_t token[COAP_TOKEN_LEN];
+	int rc;
+
+	next_token(token);
+	rc = coap_packet_init(&cpkt, tx_buf, sizeof(tx_buf), COAP_VERSION,
+			      con ? COAP_TYPE_CON : COAP_TYPE_NON_CON,
+			      COAP_TOKEN_LEN, token,
+			      COAP_METHOD_POST, next_id());
+	if (rc < 0)
+		return rc;
+
+	rc = coap_packet_append_option(&cpkt, COAP_OPTION_URI_PATH,
+				       KNOT_PATH, strlen(KNOT_PATH));
+	if (rc < 0)
+		return rc;
+
+	rc = append_payload(&cpkt, pdu, len);
+	if (rc < 0)
+		return rc;
+
+	rc = packet_send(&cpkt, false);
+
+	return (rc < 0) ? rc : len;
+}
+
+int coap6_send(const u8_t *buf, size_t len)
+{
+	bool con = true;
+	int rc;
+
+	if (len > COAP_PDU_LEN)
+		return -EMSGSIZE;
+
+	/* Observer is registered and removed by the net thread */
+	k_mutex_lock(&lock, K_FOREVER);
+
+	/* Control messages are always confirmable */
+	if (!net_is_telemetry(buf, len, &con))
+		rc = send_request(buf, len, true);
+	else if (observer.active)
+		rc = send_notification(buf, len, con);
+	else
+		rc = send_request(buf, len, con);
+
+	k_mutex_unlock(&lock);
+
+	return rc;
+}
+
+static bool option_is(const struct coap_option *opt, const char *path)
+{
+	return (opt->len == strlen(path) &&
+		memcmp(opt->value, path, opt->len) == 0);
+}
+
+/* GET /knot/data: register or remove the telemetry observer */
+static int observe_request(const struct coap_packet *req)
+{
+	struct coap_option opt;
+	bool observe;
+	int rc;
+
+	rc = coap_find_options(req, COAP_OPTION_OBSERVE, &opt, 1);
+	observe = (rc > 0 && coap_option_value_to_int(&opt) == 0);
+
+	k_mutex_lock(&lock, K_FOREVER);
+
+	observer.active = observe;
+	if (observe) {
+		observer.tkl = coap_header_get_token(req, observer.token);
+		LOG_INF("CoAP: Observer registered");
+	}
+
+	rc = send_response(req, COAP_RESPONSE_CODE_CONTENT, observe);
+
+	k_mutex_unlock(&lock);
+
+	return rc;
+}
+
+/* Message for the SM, if any, is returned at payload */
+static int request_received(const struct coap_packet *req, u8_t code,
+			    const u8_t **payload, u16_t *payload_len)
+{
+	struct coap_option path[2];
+	int rc;
+
+	rc = coap_find_options(req, COAP_OPTION_URI_PATH, path,
+			       ARRAY_SIZE(path));
+	if (rc <= 0 || !option_is(&path[0], KNOT_PATH))
+		return send_response(req, COAP_RESPONSE_CODE_NOT_FOUND, false);
+
+	if (rc == 2) {
+		if (!option_is(&path[1], DATA_PATH))
+			return send_response(req, COAP_RESPONSE_CODE_NOT_FOUND,
+					     false);
+		if (code != COAP_METHOD_GET)
+			return send_response(req,
+					COAP_RESPONSE_CODE_NOT_ALLOWED, false);
+
+		return observe_request(req);
+	}
+
+	if (code != COAP_METHOD_POST && code != COAP_METHOD_PUT)
+		return send_response(req, COAP_RESPONSE_CODE_NOT_ALLOWED,
+				     false);
+
+	*payload = coap_packet_get_payload(req, payload_len);
+	if (!*payload || *payload_len == 0) {
+		*payload = NULL;
+		return send_response(req, COAP_RESPONSE_CODE_BAD_REQUEST,
+				     false);
+	}
+
+	rc = send_response(req, COAP_RESPONSE_CODE_CHANGED, false);
+	if (rc < 0)
+		LOG_WRN("CoAP: Response failure (%d)", rc);
+
+	return 0;
+}
+
+/* Parse one CoAP message. Message for the SM, if any, is at payload */
+static int parse_msg(u8_t *buf, size_t len,
+		     const u8_t **payload, u16_t *payload_len)
+{
+	struct coap_packet cpkt;
+	struct coap_option options[COAP_MAX_OPTIONS];
+	u8_t type;
+	u8_t code;
+	u16_t id;
+	int rc;
+
+	rc = coap_packet_parse(&cpkt, buf, len, options, ARRAY_SIZE(options));
+	if (rc < 0) {
+		LOG_WRN("CoAP: Invalid message");
+		return -EINVAL;
+	}
+
+	type = coap_header_get_type(&cpkt);
+	code = coap_header_get_code(&cpkt);
+	id = coap_header_get_id(&cpkt);
+
+	if (type == COAP_TYPE_ACK || type == COAP_TYPE_RESET)
+		ack_received(id, type == COAP_TYPE_RESET);
+
+	/* Sent again by the peer: our reply was lost, not delivered again */
+	if (type == COAP_TYPE_CON && reply_resend(id)) {
+		LOG_DBG("CoAP: Duplicate msg %d", id);
+		return 0;
+	}
+
+	/* Empty: ack, reset or ping (answered with reset) */
+	if (code == COAP_CODE_EMPTY) {
+		if (type == COAP_TYPE_CON)
+			return send_empty(COAP_TYPE_RESET, id);
+		return 0;
+	}
+
+	/* Request class 0.xx */
+	if ((code >> 5) == 0)
+		return request_received(&cpkt, code, payload, payload_len);
+
+	/* Separate response: ack it */
+	if (type == COAP_TYPE_CON)
+		send_empty(COAP_TYPE_ACK, id);
+
+	if ((code >> 5) != 2) {
+		LOG_WRN("CoAP: Request failed %d.%02d", code >> 5, code & 0x1f);
+		return 0;
+	}
+
+	/* Response to POST may carry a message from the gateway */
+	*payload = coap_packet_get_payload(&cpkt, payload_len);
+	if (*payload_len == 0)
+		*payload = NULL;
+
+	return 0;
+}
+
+/* Deliver one datagram: each one holds a whole CoAP message */
+static int deliver(struct net_buf *pdu)
+{
+	const u8_t *payload = NULL;
+	u16_t payload_len = 0;
+	int rc;
+
+	rc = parse_msg(pdu->data, pdu->len, &payload, &payload_len);
+	if (rc < 0 || !payload) {
+		net_buf_unref(pdu);
+		return rc;
+	}
+
+	/* Strip header and options: payload is handed over in place */
+	net_buf_pull(pdu, payload - pdu->data);
+
+	return recv_cb(pdu);
+}
+
+static int receive(void)
+{
+	struct net_buf *pdu;
+	int rc;
+	int err;
+
+	/*
+	 * One datagram per poll event: no buffer is taken just to find the
+	 * socket empty. Net thread polls again at once if more are left.
+	 */
+	pdu = pdu_alloc(PDU_RX, K_NO_WAIT);
+	if (!pdu)
+		return -ENOBUFS;
+
+	/* Datagram is read straight into the buffer handed to PROTO */
+	rc = zsock_recv(socket, pdu->data, net_buf_tailroom(pdu),
+			ZSOCK_MSG_DONTWAIT);
+
+	if (rc > 0) {
+		net_buf_add(pdu, rc);
+		rc = deliver(pdu);
+		if (rc < 0)
+			LOG_ERR("Msg dropped (%d)", rc);
+		return 0;
+	}
+	/* Save errno to avoid changes by interruption */
+	err = errno;
+	net_buf_unref(pdu);
+
+	/* Empty datagram or nothing left */
+	if (rc == 0 || err == EAGAIN || err == EWOULDBLOCK)
+		return 0;
+
+	LOG_ERR("Socket read err: %d", rc);
+
+	if (err == EBADF)
+		coap6_stop();
+
+	return -err;
+}
+
+/* Send again confirmable messages not acked. Return time to next check */
+static s32_t process(void)
+{
+	struct coap_slot *slot;
+	s64_t next = -1;
+	s64_t now;
+	int i;
+
+	k_mutex_lock(&lock, K_FOREVER);
+
+	now = k_uptime_get();
+	for (i = 0; i < ARRAY_SIZE(slots); i++) {
+		slot = &slots[i];
+		if (!slot->used)
+			continue;
+
+		if (slot->deadline <= now) {
+			if (slot->retries >= CONFIG_KNOT_COAP_RETRIES) {
+				LOG_WRN("CoAP: Giving up msg %d", slot->id);
+				slot->used = false;
+				/* Observer gone: wait for a new register */
+				if (slot->notify)
+					observer.active = false;
+				continue;
+			}
+
+			slot->retries++;
+			slot_send(slot);
+		}
+
+		if (next < 0 || slot->deadline < next)
+			next = slot->deadline;
+	}
+
+	k_mutex_unlock(&lock);
+
+	if (next < 0)
+		return K_FOREVER;
+
+	return (next > now) ? (s32_t) (next - now) : K_NO_WAIT;
+}
+
+int coap6_start(const char *addr, net_recv_t recv, net_close_t close)
+{
+	struct sockaddr_in6 addr6;
+	int rc;
+	int err;
+
+	memset(&addr6, 0, sizeof(addr6));
+	addr6.sin6_family = AF_INET6;
+	addr6.sin6_port = htons(PEER_COAP_PORT);
+	rc = zsock_inet_pton(AF_INET6, addr, &addr6.sin6_addr);
+	if (rc <= 0)
+		return -EFAULT;
+
+	socket = zsock_socket(AF_INET6, SOCK_DGRAM, IPPROTO_UDP);
+	if (socket < 0) {
+		err = errno;
+		LOG_ERR("Failed to create CoAP socket: %d", err);
+		return -err;
+	}
+
+	/* Call connect so we can use send and recv */
+	rc = zsock_connect(socket, (struct sockaddr *) &addr6, sizeof(addr6));
+	if (rc < 0) {
+		err = errno;
+		LOG_ERR("Cannot connect to CoAP remote: %d", err);
+		coap6_stop();
+		return -err;
+	}
+
+	k_mutex_lock(&lock, K_FOREVER);
+	memset(slots, 0, sizeof(slots));
+	memset(replies, 0, sizeof(replies));
+	memset(&observer, 0, sizeof(observer));
+	k_mutex_unlock(&lock);
+
+	fds.fd = socket;
+	fds.events = ZSOCK_POLLIN;
+	recv_cb = recv;
+	close_cb = close;
+
+	LOG_DBG("CoAP started");
+
+	return 0;
+}
+
+void coap6_stop(void)
+{
+	if (socket >= 0) {
+		LOG_DBG("Closing socket %d", socket);
+		(void) zsock_close(socket);
+		socket = -1;
+	}
+
+	/* Call connection closed callback */
+	if (close_cb != NULL) {
+		LOG_WRN("Calling close cb");
+		close_cb();
+	}
+}
+
+int coap6_init(void)
+{
+	/* Reset callbacks */
+	recv_cb = NULL;
+	close_cb = NULL;
+
+	LOG_DBG("Initializing CoAP handler");
+
+	return 0;
+}
+
+int coap6_event_poll(int timeout)
+{
+	int ret, rc;
+
+	/* Wake up in time to retransmit */
+	rc = process();
+	if (rc != K_FOREVER && (timeout == K_FOREVER || rc < timeout))
+		timeout = rc;
+
+	ret = net_poll(&fds, timeout);
+	if (ret < 0)
+		LOG_ERR("Error in poll: %d", ret);
+
+	if (fds.revents & ZSOCK_POLLIN) {
+		LOG_DBG("Msg received");
+		rc = receive();
+		if (rc)
+			LOG_ERR("Read failure: %d", rc);
+	}
+
+	/* Datagram sockets fail on ICMP errors, e.g. peer unreachable */
+	if (socket >= 0 && (fds.revents & (ZSOCK_POLLERR | ZSOCK_POLLNVAL))) {
+		LOG_WRN("Socket error");
+		coap6_stop();
+	}
+
+	process();
+
+	return ret;
+}
+
+const struct net_transport coap6_transport = {
+	.name = "coap",
+	.init = coap6_init,
+	.start = coap6_start,
+	.stop = coap6_stop,
+	.send = coap6_send,
+	.event_poll = coap6_event_poll,
+};
@@ -0,0 +1,17 @@
+/* coap6.h - KNoT Application Client */
+
+/*
+ * Copyright (c) 2019, CESAR. All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+int coap6_start(const char *addr, net_recv_t recv, net_close_t close);
+void coap6_stop(void);
+
+int coap6_send(const u8_t *buf, size_t len);
+
+int coap6_event_poll(int timeout);
+int coap6_init(void);
+
+extern const struct net_transport coap6_transport;
@@ -0,0 +1,93 @@
+/* discovery.c - KNoT Application Client */
+
+/*
+ * Copyright (c) 2019, CESAR. All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * Gateway discovery: the gateway host name is resolved to an IPv6 address
+ * with the DNS resolver. Names ending in ".local" are resolved with mDNS
+ * when CONFIG_MDNS_RESOLVER is enabled, so a gateway announced by avahi or
+ * any mDNS responder on the link is found without provisioning.
+ */
+
+#include <zephyr.h>
+#include <logging/log.h>
+#include <errno.h>
+
+#include <net/net_ip.h>
+#include <net/dns_resolve.h>
+
+#include "discovery.h"
+
+LOG_MODULE_DECLARE(knot, CONFIG_KNOT_LOG_LEVEL);
+
+static K_SEM_DEFINE(done_sem, 0, 1);
+
+struct query {
+	char *addr;
+	size_t len;
+	int result;
+};
+
+static void resolve_cb(enum dns_resolve_status status,
+		       struct dns_addrinfo *info, void *user_data)
+{
+	struct query *query = user_data;
+
+	switch (status) {
+	case DNS_EAI_INPROGRESS:
+		/* Keep the first address only */
+		if (query->result == 0 || !info ||
+		    info->ai_family != AF_INET6)
+			return;
+
+		if (net_addr_ntop(AF_INET6, &net_sin6(&info->ai_addr)->sin6_addr,
+				  query->addr, query->len))
+			query->result = 0;
+		return;
+	case DNS_EAI_ALLDONE:
+		break;
+	case DNS_EAI_CANCELED:
+		query->result = (query->result == 0) ? 0 : -ETIMEDOUT;
+		break;
+	default:
+		LOG_WRN("Discovery failed (%d)", status);
+		break;
+	}
+
+	k_sem_give(&done_sem);
+}
+
+int discovery_resolve(char *addr, size_t len)
+{
+	struct query query = {
+		.addr = addr,
+		.len = len,
+		.result = -ENOENT,
+	};
+	u16_t dns_id;
+	int rc;
+
+	LOG_DBG("Resolving %s", CONFIG_KNOT_DISCOVERY_HOST);
+
+	k_sem_reset(&done_sem);
+	rc = dns_get_addr_info(CONFIG_KNOT_DISCOVERY_HOST, DNS_QUERY_TYPE_AAAA,
+			       &dns_id, resolve_cb, &query,
+			       CONFIG_KNOT_DISCOVERY_TIMEOUT);
+	if (rc) {
+		LOG_ERR("Cannot start discovery: %d", rc);
+		return rc;
+	}
+
+	/* Resolver calls back on completion, error or timeout */
+	k_sem_take(&done_sem, K_FOREVER);
+
+	if (query.result == 0)
+		LOG_INF("Gateway %s found at %s", CONFIG_KNOT_DISCOVERY_HOST,
+			addr);
+
+	return query.result;
+}
@@ -0,0 +1,10 @@
+/* discovery.h - KNoT Application Client */
+
+/*
+ * Copyright (c) 2019, CESAR. All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/* Resolve the gateway address. Blocks up to the discovery timeout */
+int discovery_resolve(char *addr, size_t len);
@@ -4,6 +4,9 @@
  * SPDX-License-Identifier: Apache-2.0
  */
 
+#include <knot/knot_types.h>
+#include <knot/knot_protocol.h>
+
 /*
  * Callback functions that can be called so the data item value can be updated
  * before/after being read/written.
@@ -15,7 +18,9 @@ typedef int (*knot_callback_t) (int id);
 
 /*
  * Similar to Arduino:
- * setup() is called once and loop() is always called at idle state.
+ * setup() is called once and loop() is called at idle state every
+ * CONFIG_KNOT_LOOP_PERIOD milliseconds, or on every wakeup of the KNoT
+ * thread if the period is 0.
  * Sensors and actuators should be registered at setup() function
  * definition and loop() must NOT be blocking.
  *
@@ -24,12 +29,120 @@ typedef int (*knot_callback_t) (int id);
 void setup(void);
 void loop(void);
 
+/* Constant description of a data item: see KNOT_DATA_DEFINE() */
+struct knot_data_desc {
+	knot_schema		schema;
+	knot_config		config;
+	void			*target;
+	size_t			target_len;
+	knot_callback_t		write_cb;
+	knot_callback_t		read_cb;
+	u8_t			id;
+};
+
+#define _KNOT_DATA_LEN_IS_VALID(value_type, len)			\
+	((value_type) == KNOT_VALUE_TYPE_BOOL ? (len) == sizeof(bool) :	\
+	 (value_type) == KNOT_VALUE_TYPE_INT ? (len) == sizeof(int) :	\
+	 (value_type) == KNOT_VALUE_TYPE_FLOAT ? (len) == sizeof(float) :	\
+	 (value_type) == KNOT_VALUE_TYPE_RAW ?				\
+		((len) > 0 && (len) <= KNOT_DATA_RAW_SIZE) : 0)
+
+/*
+ * Define a data item at build time, instead of knot_data_register() and
+ * knot_data_config() at setup(). Its schema and config are kept in flash
+ * and it is loaded before setup() is called. Aligned to its type, so
+ * the linker section is an array.
+ *
+ * @param _id Sensor ID.
+ * @param _name String literal.
+ * @param _target Watched/controlled variable, not a pointer to it.
+ * @param _event_flags KNOT_EVT_FLAG_* ORed.
+ * @param _time_sec Period if KNOT_EVT_FLAG_TIME is set.
+ * @param ... Threshold limits, as .config.upper_limit.val_i = 10
+ */
+#define KNOT_DATA_DEFINE(_id, _name, _type_id, _value_type, _unit,	\
+			 _target, _write_cb, _read_cb,			\
+			 _event_flags, _time_sec, ...)			\
+	BUILD_ASSERT_MSG((_id) < CONFIG_KNOT_THING_DATA_MAX,		\
+			 "KNoT data id out of range");			\
+	BUILD_ASSERT_MSG(sizeof(_name) - 1 <= KNOT_PROTOCOL_DATA_NAME_LEN, \
+			 "KNoT data name too long");			\
+	BUILD_ASSERT_MSG(_KNOT_DATA_LEN_IS_VALID(_value_type,		\
+						 sizeof(_target)),	\
+			 "KNoT data target incompatible with type");	\
+	BUILD_ASSERT_MSG(!((_event_flags) & KNOT_EVT_FLAG_TIME) ||	\
+			 (_time_sec) > 0, "KNoT data period not set");	\
+	const struct knot_data_desc _knot_data_##_id			\
+	__aligned(__alignof(struct knot_data_desc))			\
+	__in_section(_knot_data, static, _id) __used = {		\
+		.schema = {						\
+			.value_type = (_value_type),			\
+			.unit = (_unit),				\
+			.type_id = (_type_id),				\
+			.name = _name,					\
+		},							\
+		.config = {						\
+			.event_flags = (_event_flags),			\
+			.time_sec = (_time_sec),			\
+		},							\
+		.target = &(_target),					\
+		.target_len = sizeof(_target),				\
+		.write_cb = (_write_cb),				\
+		.read_cb = (_read_cb),					\
+		.id = (_id),						\
+		__VA_ARGS__						\
+	}
+
 /* Set knot to track and update data items */
 int knot_data_register(u8_t id, const char *name,
 		       u16_t type_id, u8_t value_type, u8_t unit,
 		       void *target, size_t target_len,
 		       knot_callback_t write_cb, knot_callback_t read_cb);
 
+/*
+ * How values written by the app from ISRs or other threads are read. Each
+ * update of a synchronized item must be done between knot_data_write_begin()
+ * and knot_data_write_end(), by a single writer at a time.
+ */
+enum knot_data_sync {
+	KNOT_DATA_SYNC_NONE,	/* Target read as is */
+	KNOT_DATA_SYNC_SEQLOCK,	/* Read retried if written meanwhile */
+	KNOT_DATA_SYNC_DOUBLE,	/* Target holds 2 values: writes never wait */
+};
+
+/*
+ * Same as knot_data_register(), with tear-free reads of the target.
+ * For KNOT_DATA_SYNC_DOUBLE, target must have room for 2 * target_len.
+ */
+int knot_data_register_sync(u8_t id, const char *name,
+			    u16_t type_id, u8_t value_type, u8_t unit,
+			    void *target, size_t target_len,
+			    knot_callback_t write_cb, knot_callback_t read_cb,
+			    enum knot_data_sync sync);
+
+/*
+ * Start an update of a data item. ISR safe.
+ *
+ * @param id Sensor ID.
+ *
+ * @return Where to write the new value. For double buffered items, it is
+ * a copy of the current value, published by knot_data_write_end().
+ */
+void *knot_data_write_begin(u8_t id);
+void knot_data_write_end(u8_t id);
+
+/*
+ * Value sent by the cloud, from the write callback. Synchronized targets
+ * are not written by KNoT: the callback applies it between
+ * knot_data_write_begin() and knot_data_write_end() instead.
+ *
+ * @param id Sensor ID.
+ * @param len Value length, shorter than target_len for some raw values.
+ *
+ * @return Value with the type of the item, or NULL out of the callback.
+ */
+const void *knot_data_get_write_value(u8_t id, size_t *len);
+
 /*
  * This fuction configures which events should send proxy value to cloud
  *
@@ -39,3 +152,51 @@ int knot_data_register(u8_t id, const char *name,
  * This function must end with NULL
  */
 bool knot_data_config(u8_t id, ...);
+
+/*
+ * Report a new value of a data item. ISR safe.
+ *
+ * The item is read at once instead of at the next scan. Once notified,
+ * an item is not sampled anymore: the app must notify every change.
+ *
+ * @param id Sensor ID.
+ */
+int knot_data_notify(u8_t id);
+
+/*
+ * Same as knot_data_notify(), but the value is given instead of read
+ * from the registered target. If notified again before being read, only
+ * the last value is sent. Periodic reads send the last notified value
+ * until the item is written by the cloud. Raw values may be shorter
+ * than target_len.
+ *
+ * @param id Sensor ID.
+ * @param value Value with the type of the item.
+ * @param len Value length.
+ */
+int knot_data_notify_value(u8_t id, const void *value, size_t len);
+
+/* Link and buffer counters since boot, e.g. for the app to report */
+struct knot_stats {
+	s32_t srtt;		/* Smoothed round trip time (ms) */
+	s32_t rto;		/* Retransmission timeout, no backoff (ms) */
+	u32_t timeouts;		/* Requests not answered in time */
+	u32_t pdu_allocs;	/* Message buffers handed out */
+	u32_t rx_exhausted;	/* No buffer to receive into */
+	u32_t tx_exhausted;	/* No buffer to build a message into */
+	u32_t tx_queue_peak;	/* Highest depth of outgoing queue */
+	u32_t tx_queue_full;	/* Times sending was held back */
+	u32_t rx_queue_peak;	/* Highest depth of incoming queue */
+	u32_t rx_queue_full;	/* Incoming messages dropped */
+	u32_t retransmits;	/* Reliable UDP only: datagrams sent again */
+	u32_t fast_retransmits;	/* Sent again before timeout: gap acked */
+	u32_t drops;		/* Datagrams given up after max retries */
+	u32_t duplicates;	/* Received datagrams already delivered */
+};
+
+/*
+ * Read KNoT counters. Thread safe.
+ *
+ * @param stats Counters, zero if not built.
+ */
+void knot_get_stats(struct knot_stats *stats);
@@ -12,22 +12,66 @@
  */
 
 #include <zephyr.h>
+#include <string.h>
 #include <net/net_core.h>
+#include <net/buf.h>
 #include <logging/log.h>
 #include <settings/settings.h>
 #if CONFIG_SETTINGS_OT
 	#include <settings/settings_ot.h>
 #endif
 
+#include "knot.h"
 #include "proto.h"
 #include "net.h"
 #include "storage.h"
+#include "pdu.h"
+#include "rto.h"
+#include "rudp.h"
 
 LOG_MODULE_REGISTER(knot, CONFIG_KNOT_LOG_LEVEL);
-K_PIPE_DEFINE(p2n_pipe, 128, 4);
-K_PIPE_DEFINE(n2p_pipe, 128, 4);
+static struct pdu_queue p2n_queue;
+static struct pdu_queue n2p_queue;
 static struct k_sem quit_lock;
 
+void knot_get_stats(struct knot_stats *stats)
+{
+	struct pdu_stats pdu;
+	struct pdu_queue_stats queue;
+	struct rto_stats rto;
+#if CONFIG_KNOT_UDP_RELIABLE
+	struct rudp_stats rudp;
+#endif
+
+	memset(stats, 0, sizeof(*stats));
+
+	rto_get_stats(&rto);
+	stats->srtt = rto.srtt;
+	stats->rto = rto.rto;
+	stats->timeouts = rto.timeouts;
+
+	pdu_get_stats(&pdu);
+	stats->pdu_allocs = pdu.allocs;
+	stats->rx_exhausted = pdu.exhausted[PDU_RX];
+	stats->tx_exhausted = pdu.exhausted[PDU_TX];
+
+	pdu_queue_get_stats(&p2n_queue, &queue);
+	stats->tx_queue_peak = queue.peak;
+	stats->tx_queue_full = queue.full;
+
+	pdu_queue_get_stats(&n2p_queue, &queue);
+	stats->rx_queue_peak = queue.peak;
+	stats->rx_queue_full = queue.full;
+
+#if CONFIG_KNOT_UDP_RELIABLE
+	rudp_get_stats(&rudp);
+	stats->retransmits = rudp.retransmits;
+	stats->fast_retransmits = rudp.fast_retransmits;
+	stats->drops = rudp.drops;
+	stats->duplicates = rudp.duplicates;
+#endif
+}
+
 void main(void)
 {
 	int ret;
@@ -61,13 +105,16 @@ void main(void)
 			LOG_ERR("Settings load failed (err %d)", ret);
 	#endif
 
+	pdu_queue_init(&p2n_queue, CONFIG_KNOT_NET_TX_QUEUE);
+	pdu_queue_init(&n2p_queue, CONFIG_KNOT_NET_RX_QUEUE);
+
 	/*
 	 * KNoT state thread: manage device registration, detects
 	 * sensor data changes acting like a proxy forwarding data
 	 * from sensors to network layer (and oposite). Proto is
 	 * consumer of ipdu fifo and producer of opdu.
 	 */
-	if (proto_start(&p2n_pipe, &n2p_pipe) < 0)
+	if (proto_start(&p2n_queue, &n2p_queue) < 0)
 		return;
 
 	/*
@@ -76,7 +123,7 @@ void main(void)
 	 * managing incoming and outgoing data. Net is consumer of
 	 * opdu fifo and producer of ipdu.
 	 */
-	if (net_start(&p2n_pipe, &n2p_pipe) < 0)
+	if (net_start(&p2n_queue, &n2p_queue) < 0)
 		return;
 
 	/* Allows NET and PROTO thread scheduling */
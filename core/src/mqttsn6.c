@@ -0,0 +1,738 @@
+/* mqttsn6.c - KNoT Application Client */
+
+/*
+ * Copyright (c) 2019, CESAR. All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * MQTT-SN transport: KNoT messages are published through a MQTT-SN
+ * gateway/broker over UDP. Topics of a thing, where <cid> is its client id:
+ *   knot/<cid>/data/<sensor_id>	data pushed by each item
+ *   knot/<cid>/up		other messages from the thing
+ *   knot/<cid>/down		messages to the thing (subscribed)
+ * Topic ids are registered while starting, so publishes carry only the
+ * 2-byte id. Data of items sent on value change is published with QoS 1
+ * and items only sent periodically use QoS 0. Data is acked to the SM by
+ * the transport: on PUBACK for QoS 1, or once sent for QoS 0.
+ */
+
+#include <zephyr.h>
+#include <logging/log.h>
+#include <errno.h>
+#include <string.h>
+
+#include <net/socket.h>
+#include <net/buf.h>
+
+#include <knot/knot_protocol.h>
+
+#include "net.h"
+#include "msg.h"
+#include "pdu.h"
+#include "proxy.h"
+#include "mqttsn6.h"
+#include "storage.h"
+
+LOG_MODULE_DECLARE(knot, CONFIG_KNOT_LOG_LEVEL);
+
+#define PEER_MQTTSN_PORT	1883
+
+/* 1-byte length field: whole message up to 255 bytes */
+#define MQTTSN_PDU_LEN		MIN(CONFIG_KNOT_PDU_SIZE, 255 - MQTTSN_HDR_MAX)
+#define MQTTSN_HDR_MAX		7	/* PUBLISH header */
+#define MQTTSN_BUF_LEN		(MQTTSN_HDR_MAX + MQTTSN_PDU_LEN)
+#define MQTTSN_CID_LEN		24
+#define MQTTSN_TOPIC_LEN	40
+
+/* Message types */
+#define MQTTSN_CONNECT		0x04
+#define MQTTSN_CONNACK		0x05
+#define MQTTSN_REGISTER		0x0A
+#define MQTTSN_REGACK		0x0B
+#define MQTTSN_PUBLISH		0x0C
+#define MQTTSN_PUBACK		0x0D
+#define MQTTSN_SUBSCRIBE	0x12
+#define MQTTSN_SUBACK		0x13
+#define MQTTSN_PINGREQ		0x16
+#define MQTTSN_PINGRESP		0x17
+#define MQTTSN_DISCONNECT	0x18
+
+/* Flags */
+#define MQTTSN_FLAG_DUP		BIT(7)
+#define MQTTSN_FLAG_QOS1	BIT(5)
+#define MQTTSN_FLAG_CLEAN	BIT(2)
+
+#define MQTTSN_PROTOCOL_ID	0x01
+#define MQTTSN_ACCEPTED		0x00
+
+struct mqttsn_slot {
+	u8_t buf[MQTTSN_BUF_LEN];
+	u8_t len;
+	u16_t msg_id;		/* Waiting PUBACK */
+	s64_t deadline;		/* Uptime to send again */
+	u8_t retries;
+	u8_t data_type;		/* Data request acked on PUBACK or 0 */
+	u8_t data_key;		/* Sensor id or batch sequence number */
+	bool used;
+};
+
+static char client_id[MQTTSN_CID_LEN];
+static struct zsock_pollfd fds;
+static net_recv_t recv_cb;
+static net_close_t close_cb;
+static int socket = -1;
+
+static u16_t up_topic;
+static u16_t down_topic;
+static u16_t data_topic[CONFIG_KNOT_THING_DATA_MAX];	/* 0: none */
+
+static struct mqttsn_slot slots[CONFIG_KNOT_MQTTSN_TX_SLOTS];
+static u16_t next_msg_id;
+static s64_t last_tx;		/* Uptime of last message sent */
+static s64_t ping_sent;		/* PINGREQ waiting response or 0 */
+static K_MUTEX_DEFINE(lock);
+
+/* Off the stacks: sent while locked */
+static u8_t tx_buf[MQTTSN_BUF_LEN];
+
+static u16_t get_u16(const u8_t *buf)
+{
+	return (buf[0] << 8) | buf[1];
+}
+
+static void put_u16(u8_t *buf, u16_t val)
+{
+	buf[0] = val >> 8;
+	buf[1] = val & 0xff;
+}
+
+static u16_t msg_id_next(void)
+{
+	/* Zero is not a valid message id */
+	if (++next_msg_id == 0)
+		next_msg_id = 1;
+
+	return next_msg_id;
+}
+
+static int socket_send(const u8_t *buf, size_t len)
+{
+	ssize_t out_len;
+
+	out_len = zsock_send(socket, buf, len, 0);
+	if (out_len < 0)
+		return -errno;
+
+	last_tx = k_uptime_get();
+
+	return out_len;
+}
+
+/* Send message and wait for its response. Used while starting only */
+static int exchange(const u8_t *req, size_t req_len, u8_t rsp_type,
+		    u8_t *rsp, size_t rsp_size)
+{
+	int tries;
+	int rc;
+
+	for (tries = 0; tries <= CONFIG_KNOT_MQTTSN_RETRIES; tries++) {
+		rc = socket_send(req, req_len);
+		if (rc < 0)
+			return rc;
+
+		/* Ignore anything else until response or timeout */
+		while (zsock_poll(&fds, 1, CONFIG_KNOT_MQTTSN_TIMEOUT) > 0) {
+			rc = zsock_recv(socket, rsp, rsp_size,
+					ZSOCK_MSG_DONTWAIT);
+			if (rc < 0) {
+				if (errno == EAGAIN || errno == EWOULDBLOCK)
+					continue;
+				return -errno;
+			}
+
+			if (rc >= 2 && rsp[0] == rc && rsp[1] == rsp_type)
+				return rc;
+		}
+	}
+
+	return -ETIMEDOUT;
+}
+
+static int send_connect(void)
+{
+	u8_t buf[6 + MQTTSN_CID_LEN];
+	u8_t rsp[3];
+	size_t cid_len = strlen(client_id);
+	int rc;
+
+	buf[0] = 6 + cid_len;
+	buf[1] = MQTTSN_CONNECT;
+	buf[2] = MQTTSN_FLAG_CLEAN;
+	buf[3] = MQTTSN_PROTOCOL_ID;
+	put_u16(&buf[4], CONFIG_KNOT_MQTTSN_KEEPALIVE);
+	memcpy(&buf[6], client_id, cid_len);
+
+	rc = exchange(buf, buf[0], MQTTSN_CONNACK, rsp, sizeof(rsp));
+	if (rc < 0)
+		return rc;
+
+	if (rc != sizeof(rsp) || rsp[2] != MQTTSN_ACCEPTED) {
+		LOG_ERR("MQTT-SN: Connection refused");
+		return -ECONNREFUSED;
+	}
+
+	return 0;
+}
+
+/* Register topic name at the broker and return its id */
+static int register_topic(const char *name, u16_t *topic_id)
+{
+	u8_t buf[6 + MQTTSN_TOPIC_LEN];
+	u8_t rsp[7];
+	size_t name_len = strlen(name);
+	u16_t msg_id = msg_id_next();
+	int rc;
+
+	buf[0] = 6 + name_len;
+	buf[1] = MQTTSN_REGISTER;
+	put_u16(&buf[2], 0);
+	put_u16(&buf[4], msg_id);
+	memcpy(&buf[6], name, name_len);
+
+	rc = exchange(buf, buf[0], MQTTSN_REGACK, rsp, sizeof(rsp));
+	if (rc < 0)
+		return rc;
+
+	if (rc != sizeof(rsp) || get_u16(&rsp[4]) != msg_id ||
+	    rsp[6] != MQTTSN_ACCEPTED) {
+		LOG_ERR("MQTT-SN: Register %s rejected", name);
+		return -EPERM;
+	}
+
+	*topic_id = get_u16(&rsp[2]);
+
+	return 0;
+}
+
+static int subscribe_topic(const char *name, u16_t *topic_id)
+{
+	u8_t buf[5 + MQTTSN_TOPIC_LEN];
+	u8_t rsp[8];
+	size_t name_len = strlen(name);
+	u16_t msg_id = msg_id_next();
+	int rc;
+
+	buf[0] = 5 + name_len;
+	buf[1] = MQTTSN_SUBSCRIBE;
+	buf[2] = MQTTSN_FLAG_QOS1;
+	put_u16(&buf[3], msg_id);
+	memcpy(&buf[5], name, name_len);
+
+	rc = exchange(buf, buf[0], MQTTSN_SUBACK, rsp, sizeof(rsp));
+	if (rc < 0)
+		return rc;
+
+	if (rc != sizeof(rsp) || get_u16(&rsp[5]) != msg_id ||
+	    rsp[7] != MQTTSN_ACCEPTED) {
+		LOG_ERR("MQTT-SN: Subscribe %s rejected", name);
+		return -EPERM;
+	}
+
+	*topic_id = get_u16(&rsp[3]);
+
+	return 0;
+}
+
+/* Connect, subscribe to commands and register topics of all items */
+static int session_start(void)
+{
+	char topic[MQTTSN_TOPIC_LEN];
+	int rc;
+	int id;
+
+	rc = send_connect();
+	if (rc)
+		return rc;
+
+	snprintk(topic, sizeof(topic), "knot/%s/down", client_id);
+	rc = subscribe_topic(topic, &down_topic);
+	if (rc)
+		return rc;
+
+	snprintk(topic, sizeof(topic), "knot/%s/up", client_id);
+	rc = register_topic(topic, &up_topic);
+	if (rc)
+		return rc;
+
+	for (id = 0; id < CONFIG_KNOT_THING_DATA_MAX; id++) {
+		data_topic[id] = 0;
+		if (proxy_get_schema(id) == NULL)
+			continue;
+
+		snprintk(topic, sizeof(topic), "knot/%s/data/%d",
+			 client_id, id);
+		rc = register_topic(topic, &data_topic[id]);
+		if (rc)
+			return rc;
+	}
+
+	return 0;
+}
+
+static void slot_send(struct mqttsn_slot *slot)
+{
+	(void) socket_send(slot->buf, slot->len);
+
+	slot->deadline = k_uptime_get() + CONFIG_KNOT_MQTTSN_TIMEOUT;
+}
+
+/*
+ * Data published is not answered by the gateway: respond to the SM as it
+ * would, identified by the sensor id or the batch sequence number.
+ */
+static void data_acked(u8_t type, u8_t key)
+{
+	struct net_buf *pdu;
+	knot_msg *msg;
+
+	/* Not acked: SM sends it again on its timeout */
+	pdu = pdu_alloc(PDU_RX, K_NO_WAIT);
+	if (!pdu)
+		return;
+
+	msg = (knot_msg *) net_buf_add(pdu, sizeof(msg->hdr) +
+				       sizeof(msg->action.result) + 1);
+	msg->hdr.type = (type == KNOT_MSG_PUSH_DATA_REQ) ?
+			KNOT_MSG_PUSH_DATA_RSP : KNOT_MSG_PUSH_DATA_BATCH_RSP;
+	msg->hdr.payload_len = sizeof(msg->action.result) + 1;
+	msg->action.result = 0;
+	*((u8_t *) &msg->action.result + 1) = key;
+
+	(void) recv_cb(pdu);
+}
+
+static int publish(u16_t topic_id, bool qos1, const u8_t *pdu, size_t len,
+		   bool data)
+{
+	const knot_msg *kmsg = (const knot_msg *) pdu;
+	struct mqttsn_slot *slot = NULL;
+	u8_t *msg;
+	int rc;
+	int i;
+
+	k_mutex_lock(&lock, K_FOREVER);
+
+	if (qos1) {
+		for (i = 0; i < ARRAY_SIZE(slots); i++) {
+			if (!slots[i].used) {
+				slot = &slots[i];
+				break;
+			}
+		}
+
+		/* All slots waiting ack: net thread holds the PDU until free */
+		if (!slot) {
+			k_mutex_unlock(&lock);
+			LOG_WRN("MQTT-SN: No slot available");
+			return -ENOBUFS;
+		}
+	}
+
+	msg = slot ? slot->buf : tx_buf;
+	msg[0] = MQTTSN_HDR_MAX + len;
+	msg[1] = MQTTSN_PUBLISH;
+	msg[2] = qos1 ? MQTTSN_FLAG_QOS1 : 0;
+	put_u16(&msg[3], topic_id);
+	put_u16(&msg[5], qos1 ? msg_id_next() : 0);
+	memcpy(&msg[MQTTSN_HDR_MAX], pdu, len);
+
+	if (slot) {
+		slot->len = msg[0];
+		slot->msg_id = get_u16(&msg[5]);
+		slot->retries = 0;
+		slot->data_type = data ? kmsg->hdr.type : 0;
+		slot->data_key = pdu[sizeof(kmsg->hdr)];
+		slot->used = true;
+		slot_send(slot);
+		rc = len;
+	} else {
+		rc = socket_send(msg, msg[0]);
+		if (rc >= 0)
+			rc = len;
+	}
+
+	k_mutex_unlock(&lock);
+
+	/* QoS 0: nothing else to wait for */
+	if (data && !qos1 && rc >= 0)
+		data_acked(kmsg->hdr.type, pdu[sizeof(kmsg->hdr)]);
+
+	return rc;
+}
+
+int mqttsn6_send(const u8_t *buf, size_t len)
+{
+	const knot_msg *msg = (const knot_msg *) buf;
+	bool qos1 = true;
+	bool data;
+
+	if (len > MQTTSN_PDU_LEN)
+		return -EMSGSIZE;
+
+	/* Sensor id or sequence number follows the header */
+	data = net_is_telemetry(buf, len, &qos1) &&
+	       len > sizeof(msg->hdr);
+
+	/* Data of a single item goes to its own topic */
+	if (data && msg->hdr.type == KNOT_MSG_PUSH_DATA_REQ &&
+	    msg->data.sensor_id < CONFIG_KNOT_THING_DATA_MAX &&
+	    data_topic[msg->data.sensor_id])
+		return publish(data_topic[msg->data.sensor_id], qos1, buf, len,
+			       data);
+
+	return publish(up_topic, qos1, buf, len, data);
+}
+
+static void puback_received(const u8_t *buf, size_t len)
+{
+	u8_t data_type = 0;
+	u8_t data_key = 0;
+	u16_t msg_id;
+	int i;
+
+	if (len != 7)
+		return;
+
+	msg_id = get_u16(&buf[4]);
+	if (buf[6] != MQTTSN_ACCEPTED)
+		LOG_WRN("MQTT-SN: Publish %d rejected (%d)", msg_id, buf[6]);
+
+	k_mutex_lock(&lock, K_FOREVER);
+
+	for (i = 0; i < ARRAY_SIZE(slots); i++) {
+		if (slots[i].used && slots[i].msg_id == msg_id) {
+			slots[i].used = false;
+			data_type = slots[i].data_type;
+			data_key = slots[i].data_key;
+			break;
+		}
+	}
+
+	k_mutex_unlock(&lock);
+
+	/* Rejected: SM sends it again on its timeout */
+	if (data_type && buf[6] == MQTTSN_ACCEPTED)
+		data_acked(data_type, data_key);
+}
+
+static int publish_received(struct net_buf *pdu)
+{
+	u8_t *buf = pdu->data;
+	u8_t ack[7];
+
+	if (pdu->len <= MQTTSN_HDR_MAX) {
+		net_buf_unref(pdu);
+		return -EINVAL;
+	}
+
+	/* Ack QoS 1 messages: duplicates included, previous ack may be lost */
+	if (buf[2] & MQTTSN_FLAG_QOS1) {
+		ack[0] = sizeof(ack);
+		ack[1] = MQTTSN_PUBACK;
+		memcpy(&ack[2], &buf[3], 4);	/* Topic id and msg id */
+		ack[6] = MQTTSN_ACCEPTED;
+		socket_send(ack, sizeof(ack));
+	}
+
+	if (get_u16(&buf[3]) != down_topic) {
+		LOG_WRN("MQTT-SN: Unknown topic %d", get_u16(&buf[3]));
+		net_buf_unref(pdu);
+		return 0;
+	}
+
+	/* Strip header: message is handed over in place */
+	net_buf_pull(pdu, MQTTSN_HDR_MAX);
+
+	return recv_cb(pdu);
+}
+
+/* Deliver one datagram: each one holds a whole MQTT-SN message */
+static int deliver(struct net_buf *pdu)
+{
+	u8_t *buf = pdu->data;
+	size_t len = pdu->len;
+	int rc = 0;
+
+	/* Only 1-byte length is used: messages are shorter than 256 */
+	if (len < 2 || buf[0] != len) {
+		LOG_WRN("MQTT-SN: Invalid message");
+		net_buf_unref(pdu);
+		return -EINVAL;
+	}
+
+	/* PUBLISH buffer is handed over: every other one is released here */
+	if (buf[1] == MQTTSN_PUBLISH)
+		return publish_received(pdu);
+
+	switch (buf[1]) {
+	case MQTTSN_PUBACK:
+		puback_received(buf, len);
+		break;
+	case MQTTSN_PINGRESP:
+		ping_sent = 0;
+		break;
+	case MQTTSN_DISCONNECT:
+		LOG_WRN("MQTT-SN: Disconnected by broker");
+		mqttsn6_stop();
+		rc = -ENOTCONN;
+		break;
+	default:
+		LOG_DBG("MQTT-SN: Msg 0x%02x ignored", buf[1]);
+		break;
+	}
+
+	net_buf_unref(pdu);
+
+	return rc;
+}
+
+static int receive(void)
+{
+	struct net_buf *pdu;
+	int rc;
+	int err;
+
+	if (socket < 0)
+		return -ENOTCONN;
+
+	/*
+	 * One datagram per poll event: no buffer is taken just to find the
+	 * socket empty. Net thread polls again at once if more are left.
+	 */
+	pdu = pdu_alloc(PDU_RX, K_NO_WAIT);
+	if (!pdu)
+		return -ENOBUFS;
+
+	/* Datagram is read straight into the buffer handed to PROTO */
+	rc = zsock_recv(socket, pdu->data, net_buf_tailroom(pdu),
+			ZSOCK_MSG_DONTWAIT);
+
+	if (rc > 0) {
+		net_buf_add(pdu, rc);
+		rc = deliver(pdu);
+		if (rc < 0)
+			LOG_ERR("Msg dropped (%d)", rc);
+		return 0;
+	}
+	/* Save errno to avoid changes by interruption */
+	err = errno;
+	net_buf_unref(pdu);
+
+	/* Empty datagram or nothing left */
+	if (rc == 0 || err == EAGAIN || err == EWOULDBLOCK)
+		return 0;
+
+	LOG_ERR("Socket read err: %d", rc);
+
+	if (err == EBADF)
+		mqttsn6_stop();
+
+	return -err;
+}
+
+/* Send again QoS 1 publishes and keep alive. Return time to next check */
+static s32_t process(void)
+{
+	struct mqttsn_slot *slot;
+	u8_t ping[2] = { sizeof(ping), MQTTSN_PINGREQ };
+	s64_t ping_timeout;
+	s64_t next;
+	s64_t now;
+	int i;
+
+	k_mutex_lock(&lock, K_FOREVER);
+
+	now = k_uptime_get();
+	for (i = 0; i < ARRAY_SIZE(slots); i++) {
+		slot = &slots[i];
+		if (!slot->used || slot->deadline > now)
+			continue;
+
+		if (slot->retries >= CONFIG_KNOT_MQTTSN_RETRIES) {
+			LOG_WRN("MQTT-SN: Giving up msg %d", slot->msg_id);
+			slot->used = false;
+			continue;
+		}
+
+		slot->retries++;
+		slot->buf[2] |= MQTTSN_FLAG_DUP;
+		slot_send(slot);
+	}
+
+	/* Broker gone if no PINGRESP after all retries */
+	ping_timeout = ping_sent + CONFIG_KNOT_MQTTSN_TIMEOUT *
+		       (CONFIG_KNOT_MQTTSN_RETRIES + 1);
+	if (ping_sent && ping_timeout <= now) {
+		k_mutex_unlock(&lock);
+		LOG_WRN("MQTT-SN: Broker not responding");
+		mqttsn6_stop();
+		return K_FOREVER;
+	}
+
+	/* Keep alive: ping if idle for the whole period */
+	if (!ping_sent &&
+	    last_tx + K_SECONDS(CONFIG_KNOT_MQTTSN_KEEPALIVE) <= now) {
+		socket_send(ping, sizeof(ping));
+		ping_sent = now;
+		ping_timeout = now + CONFIG_KNOT_MQTTSN_TIMEOUT *
+			       (CONFIG_KNOT_MQTTSN_RETRIES + 1);
+	}
+
+	next = ping_sent ? ping_timeout :
+	       last_tx + K_SECONDS(CONFIG_KNOT_MQTTSN_KEEPALIVE);
+	for (i = 0; i < ARRAY_SIZE(slots); i++) {
+		if (slots[i].used && slots[i].deadline < next)
+			next = slots[i].deadline;
+	}
+
+	k_mutex_unlock(&lock);
+
+	return (next > now) ? (s32_t) (next - now) : K_NO_WAIT;
+}
+
+static void set_client_id(void)
+{
+	u64_t devid;
+	int rc;
+
+	/* Device id is only known after registering: use random one before */
+	rc = storage_read(STORAGE_CRED_DEVID, &devid, sizeof(devid));
+	if (rc <= 0)
+		devid = ((u64_t) sys_rand32_get() << 32) | sys_rand32_get();
+
+	snprintk(client_id, sizeof(client_id), "knot-%08x%08x",
+		 (u32_t) (devid >> 32), (u32_t) devid);
+}
+
+int mqttsn6_start(const char *addr, net_recv_t recv, net_close_t close)
+{
+	struct sockaddr_in6 addr6;
+	int rc;
+	int err;
+
+	memset(&addr6, 0, sizeof(addr6));
+	addr6.sin6_family = AF_INET6;
+	addr6.sin6_port = htons(PEER_MQTTSN_PORT);
+	rc = zsock_inet_pton(AF_INET6, addr, &addr6.sin6_addr);
+	if (rc <= 0)
+		return -EFAULT;
+
+	socket = zsock_socket(AF_INET6, SOCK_DGRAM, IPPROTO_UDP);
+	if (socket < 0) {
+		err = errno;
+		LOG_ERR("Failed to create MQTT-SN socket: %d", err);
+		return -err;
+	}
+
+	/* Call connect so we can use send and recv */
+	rc = zsock_connect(socket, (struct sockaddr *) &addr6, sizeof(addr6));
+	if (rc < 0) {
+		err = errno;
+		LOG_ERR("Cannot connect to MQTT-SN remote: %d", err);
+		mqttsn6_stop();
+		return -err;
+	}
+
+	fds.fd = socket;
+	fds.events = ZSOCK_POLLIN;
+
+	memset(slots, 0, sizeof(slots));
+	ping_sent = 0;
+	set_client_id();
+
+	rc = session_start();
+	if (rc) {
+		LOG_ERR("MQTT-SN session failure: %d", rc);
+		mqttsn6_stop();
+		return rc;
+	}
+
+	recv_cb = recv;
+	close_cb = close;
+
+	LOG_DBG("MQTT-SN connected as %s", client_id);
+
+	return 0;
+}
+
+void mqttsn6_stop(void)
+{
+	u8_t disconnect[2] = { sizeof(disconnect), MQTTSN_DISCONNECT };
+
+	if (socket >= 0) {
+		(void) socket_send(disconnect, sizeof(disconnect));
+		LOG_DBG("Closing socket %d", socket);
+		(void) zsock_close(socket);
+		socket = -1;
+	}
+
+	/* Call connection closed callback */
+	if (close_cb != NULL) {
+		LOG_WRN("Calling close cb");
+		close_cb();
+	}
+}
+
+int mqttsn6_init(void)
+{
+	/* Reset callbacks */
+	recv_cb = NULL;
+	close_cb = NULL;
+
+	LOG_DBG("Initializing MQTT-SN handler");
+
+	return 0;
+}
+
+int mqttsn6_event_poll(int timeout)
+{
+	int ret, rc;
+
+	/* Wake up in time to retransmit or keep alive */
+	rc = process();
+	if (socket < 0)
+		return -ENOTCONN;
+
+	if (rc != K_FOREVER && (timeout == K_FOREVER || rc < timeout))
+		timeout = rc;
+
+	ret = net_poll(&fds, timeout);
+	if (ret < 0)
+		LOG_ERR("Error in poll: %d", ret);
+
+	if (fds.revents & ZSOCK_POLLIN) {
+		LOG_DBG("Msg received");
+		rc = receive();
+		if (rc)
+			LOG_ERR("Read failure: %d", rc);
+	}
+
+	/* Datagram sockets fail on ICMP errors, e.g. peer unreachable */
+	if (socket >= 0 && (fds.revents & (ZSOCK_POLLERR | ZSOCK_POLLNVAL))) {
+		LOG_WRN("Socket error");
+		mqttsn6_stop();
+	}
+
+	return ret;
+}
+
+const struct net_transport mqttsn6_transport = {
+	.name = "mqttsn",
+	.init = mqttsn6_init,
+	.start = mqttsn6_start,
+	.stop = mqttsn6_stop,
+	.send = mqttsn6_send,
+	.event_poll = mqttsn6_event_poll,
+};
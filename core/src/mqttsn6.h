@@ -0,0 +1,17 @@
+/* mqttsn6.h - KNoT Application Client */
+
+/*
+ * Copyright (c) 2019, CESAR. All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+int mqttsn6_start(const char *addr, net_recv_t recv, net_close_t close);
+void mqttsn6_stop(void);
+
+int mqttsn6_send(const u8_t *buf, size_t len);
+
+int mqttsn6_event_poll(int timeout);
+int mqttsn6_init(void);
+
+extern const struct net_transport mqttsn6_transport;
@@ -74,6 +74,37 @@ size_t msg_create_data(knot_msg *msg, u8_t id,
 	return (sizeof(msg->hdr) + msg->hdr.payload_len);
 }
 
+size_t msg_create_data_batch(knot_msg *msg, u8_t seq)
+{
+	u8_t *payload = (u8_t *) msg + sizeof(msg->hdr);
+
+	msg->hdr.type = KNOT_MSG_PUSH_DATA_BATCH_REQ;
+	payload[0] = seq;
+	msg->hdr.payload_len = sizeof(seq);
+
+	return (sizeof(msg->hdr) + msg->hdr.payload_len);
+}
+
+size_t msg_add_data_batch(knot_msg *msg, size_t max_len, u8_t id,
+			  const knot_value_type *value, u8_t value_len)
+{
+	u8_t *item = (u8_t *) msg + sizeof(msg->hdr) + msg->hdr.payload_len;
+	size_t item_len = sizeof(id) + sizeof(value_len) + value_len;
+	size_t len = sizeof(msg->hdr) + msg->hdr.payload_len;
+
+	/* Item doesn't fit on buffer or on payload length */
+	if (len + item_len > max_len ||
+	    msg->hdr.payload_len + item_len > UINT8_MAX)
+		return 0;
+
+	item[0] = id;
+	item[1] = value_len;
+	memcpy(&item[2], value, value_len);
+	msg->hdr.payload_len += item_len;
+
+	return (len + item_len);
+}
+
 size_t msg_create_unreg(knot_msg *msg)
 {
 	msg->hdr.type = KNOT_MSG_UNREG_RSP;
@@ -81,3 +112,11 @@ size_t msg_create_unreg(knot_msg *msg)
 
 	return sizeof(msg->hdr);
 }
+
+size_t msg_create_keepalive(knot_msg *msg, bool resp)
+{
+	msg->hdr.type = resp ? KNOT_MSG_KEEPALIVE_RSP : KNOT_MSG_KEEPALIVE_REQ;
+	msg->hdr.payload_len = 0;
+
+	return sizeof(msg->hdr);
+}
@@ -4,6 +4,25 @@
  * SPDX-License-Identifier: Apache-2.0
  */
 
+/*
+ * Protocol extension: several data items sent in one message.
+ * Request payload: sequence number followed by (sensor_id, len, value)
+ * tuples. Response payload: result followed by the sequence number.
+ */
+#ifndef KNOT_MSG_PUSH_DATA_BATCH_REQ
+#define KNOT_MSG_PUSH_DATA_BATCH_REQ	0x70
+#define KNOT_MSG_PUSH_DATA_BATCH_RSP	0x71
+#endif
+
+/*
+ * Protocol extension: keepalive sent by an idle peer to check the other
+ * one is still there. Both have no payload.
+ */
+#ifndef KNOT_MSG_KEEPALIVE_REQ
+#define KNOT_MSG_KEEPALIVE_REQ		0x72
+#define KNOT_MSG_KEEPALIVE_RSP		0x73
+#endif
+
 size_t msg_create_error(knot_msg *msg, uint8_t id, int8_t result);
 size_t msg_create_reg(knot_msg *msg, uint64_t id,
 		      const char *name, size_t name_len);
@@ -13,4 +32,8 @@ size_t msg_create_schema(knot_msg *msg, u8_t id,
 size_t msg_create_data(knot_msg *msg, u8_t id,
 		       const knot_value_type *value, uint8_t value_len,
 		       bool resp);
+size_t msg_create_data_batch(knot_msg *msg, u8_t seq);
+size_t msg_add_data_batch(knot_msg *msg, size_t max_len, u8_t id,
+			  const knot_value_type *value, u8_t value_len);
 size_t msg_create_unreg(knot_msg *msg);
+size_t msg_create_keepalive(knot_msg *msg, bool resp);
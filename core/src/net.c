@@ -12,17 +12,28 @@
  */
 
 #include <zephyr.h>
+#include <string.h>
 #include <net/net_core.h>
 #include <net/net_pkt.h>
+#include <net/net_context.h>
+#include <net/socket.h>
 #include <net/buf.h>
+#include <misc/fdtable.h>
 #include <logging/log.h>
 
+#include <knot/knot_protocol.h>
+
 #include "net.h"
-#if CONFIG_NET_UDP
-#include "udp6.h"
-#elif CONFIG_NET_TCP
+#include "msg.h"
+#include "proto.h"
+#include "proxy.h"
+#include "peer.h"
+#include "pdu.h"
+#include "storage.h"
 #include "tcp6.h"
-#endif
+#include "udp6.h"
+#include "coap6.h"
+#include "mqttsn6.h"
 #if CONFIG_SETTINGS_OT
 	#include "ot_config.h"
 #endif
@@ -31,38 +42,154 @@ LOG_MODULE_DECLARE(knot, CONFIG_KNOT_LOG_LEVEL);
 
 static struct k_thread rx_thread_data;
 static K_THREAD_STACK_DEFINE(rx_stack, 1024);
-static struct k_pipe *proto2net;
-static struct k_pipe *net2proto;
+static struct pdu_queue *proto2net;
+static struct pdu_queue *net2proto;
 static bool connected;
+static bool tx_held;		/* Transport busy: PDU queued back */
+
+/* Wakes up the net thread: data queued to send is signaled by its fifo */
+static struct k_poll_signal wakeup_signal =
+	K_POLL_SIGNAL_INITIALIZER(wakeup_signal);
+
+enum {
+	EVENT_WAKEUP,
+	EVENT_TX,
+	EVENT_SOCKET,
+	EVENT_RX_FREE,
+};
 
 K_SEM_DEFINE(conn_sem, 0, 1);
 
-#define CONN_RETRY_TIME K_SECONDS(5)
+#define TRANSPORT_NAME_LEN	8
+
+/* Transport backends available on this build */
+static const struct net_transport *transports[] = {
+#if CONFIG_NET_TCP
+	&tcp6_transport,
+#endif
+#if CONFIG_NET_UDP
+	&udp6_transport,
+#endif
+#if CONFIG_KNOT_COAP
+	&coap6_transport,
+#endif
+#if CONFIG_KNOT_MQTTSN
+	&mqttsn6_transport,
+#endif
+};
+
+BUILD_ASSERT_MSG(ARRAY_SIZE(transports) > 0,
+		 "No KNoT transport enabled: enable NET_TCP or NET_UDP");
+
+static const struct net_transport *transport;	/* Active backend */
+static u8_t transport_idx;
+static u8_t preferred_idx;	/* Backend selected from storage */
+static s64_t fallback_time;	/* Uptime of last fall back or retry */
+static u8_t conn_failures;	/* Rounds all peers failed on the backend */
+static u8_t conn_attempts;	/* Consecutive failures since connected */
+static atomic_t reconnect;	/* Connection restart requested */
+
+/* Select backend stored or the first one available */
+static void transport_select(void)
+{
+	char name[TRANSPORT_NAME_LEN];
+	int rc;
+	int i;
+
+	transport_idx = 0;
+
+	rc = storage_read(STORAGE_TRANSPORT, name, sizeof(name));
+	if (rc > 0) {
+		name[MIN(rc, sizeof(name) - 1)] = '\0';
+		for (i = 0; i < ARRAY_SIZE(transports); i++) {
+			if (strcmp(transports[i]->name, name) == 0) {
+				transport_idx = i;
+				break;
+			}
+		}
+	}
+
+	preferred_idx = transport_idx;
+	transport = transports[transport_idx];
+	LOG_INF("NET: Using %s transport", transport->name);
+}
+
+/* Fall back to the next backend available */
+static int transport_fallback(void)
+{
+	int ret;
+	int i;
+
+	for (i = 1; i < ARRAY_SIZE(transports); i++) {
+		transport_idx = (transport_idx + 1) % ARRAY_SIZE(transports);
+		transport = transports[transport_idx];
+
+		ret = transport->init();
+		if (ret == 0) {
+			LOG_WRN("NET: Falling back to %s transport",
+				transport->name);
+			fallback_time = k_uptime_get();
+			return 0;
+		}
+
+		LOG_ERR("Failed to init %s handler", transport->name);
+	}
+
+	return -ENOENT;
+}
+
+/* Time to try the preferred backend again: fallback may be temporary */
+static bool preferred_due(void)
+{
+	return (transport_idx != preferred_idx &&
+		k_uptime_get() - fallback_time >=
+		K_SECONDS(CONFIG_KNOT_NET_PREFERRED_RETRY));
+}
+
+static void transport_preferred(void)
+{
+	fallback_time = k_uptime_get();
+
+	if (transports[preferred_idx]->init()) {
+		LOG_ERR("Failed to init %s handler",
+			transports[preferred_idx]->name);
+		return;
+	}
+
+	/* Falls back again after as many failures */
+	transport_idx = preferred_idx;
+	transport = transports[transport_idx];
+	conn_failures = 0;
+	peer_round_start();
+	LOG_INF("NET: Trying %s transport again", transport->name);
+}
 
 static void close_cb(void)
 {
+	/* Connection lost: back off before reconnecting as well */
+	if (connected) {
+		conn_attempts = 1;
+		peer_failed();
+	}
+
 	/* Flag as not connected */
 	k_sem_take(&conn_sem, K_NO_WAIT);
 	connected = false;
+	proto_wakeup();
 }
 
-static int recv_cb(void *buf, size_t len)
+static int recv_cb(struct net_buf *pdu)
 {
-	int rc;
-	u8_t opdu[128];
+	int ret;
 
-	if (len > sizeof(opdu)) {
-		LOG_ERR("NET: SMALL PDU");
-		return -EMSGSIZE;
-	}
+	/* Sending recv buffer to PROTO thread: no copy */
+	ret = pdu_queue_put(net2proto, pdu);
 
-	memcpy(opdu, buf, len);
-	/* Sending recv data to PROTO thread */
-	rc = k_pipe_put(net2proto, opdu, len, &len, len, K_NO_WAIT);
-	if (rc)
-		LOG_ERR("Pipe write failed. Err: %d", rc);
+	/* PROTO is behind: drop it and let the gateway send it again */
+	if (ret)
+		net_buf_unref(pdu);
 
-	return rc;
+	return ret;
 }
 
 void ot_disconn(void)
@@ -74,6 +201,8 @@ void ot_disconn(void)
 
 static int connection_start(void)
 {
+	const char *addr;
+	s64_t start;
 	int ret;
 
 	LOG_DBG("Waiting for OpenThread to be ready...");
@@ -82,109 +211,210 @@ static int connection_start(void)
 			k_sleep(100);
 	#endif
 
-	#if CONFIG_NET_UDP
-		ret = udp6_start(recv_cb, close_cb);
-		if (ret < 0) {
-			LOG_DBG("NET: UDP start failure");
-			goto done;
-		}
-		LOG_DBG("NET: UDP started");
-	#elif CONFIG_NET_TCP
-		ret = tcp6_start(recv_cb, close_cb);
-		if (ret < 0) {
-			LOG_DBG("NET: TCP start failure");
-			goto done;
-		}
+	addr = peer_select();
+	if (!addr) {
+		ret = -EHOSTUNREACH;
+		goto done;
+	}
 
-		LOG_DBG("NET: TCP started");
-	#endif
+	start = k_uptime_get();
+
+	ret = transport->start(addr, recv_cb, close_cb);
+	if (ret < 0) {
+		LOG_DBG("NET: %s start failure", transport->name);
+		peer_failed();
+
+		/*
+		 * Try another backend if this one keeps failing: a single
+		 * peer down says nothing about the backend.
+		 */
+		if (peer_round_failed() &&
+		    ++conn_failures >= CONFIG_KNOT_NET_FALLBACK_RETRIES &&
+		    transport_fallback() == 0)
+			conn_failures = 0;
+
+		goto done;
+	}
+
+	LOG_DBG("NET: %s started", transport->name);
+	peer_connected(k_uptime_get() - start);
+	conn_failures = 0;
+	conn_attempts = 0;
+	atomic_clear(&reconnect);
 
 	connected = true;
 	k_sem_give(&conn_sem);
+	proto_wakeup();
 
 done:
 	return ret;
 }
 
-static void net_thread(void)
+/* Data pushes: transports may send them with a lighter delivery */
+bool net_is_telemetry(const u8_t *pdu, size_t len, bool *reliable)
 {
-	u8_t ipdu[128];
-	size_t ilen;
+	const knot_msg *msg = (const knot_msg *) pdu;
+	const u8_t *item;
+	const u8_t *end;
+
+	if (len < sizeof(knot_msg_header))
+		return false;
+
+	switch (msg->hdr.type) {
+	case KNOT_MSG_PUSH_DATA_REQ:
+		*reliable = proxy_is_event_driven(msg->data.sensor_id);
+		return true;
+	case KNOT_MSG_PUSH_DATA_BATCH_REQ:
+		/* Skip sequence number and check (id, len, value) tuples */
+		item = pdu + sizeof(knot_msg_header) + 1;
+		end = pdu + len;
+		*reliable = false;
+		while (item + 2 <= end && !*reliable) {
+			*reliable = proxy_is_event_driven(item[0]);
+			item += 2 + item[1];
+		}
+		return true;
+	default:
+		return false;
+	}
+}
+
+/* Send data queued by PROTO thread */
+static void tx_flush(void)
+{
+	struct net_buf *pdu;
 	int ret;
 
-	#if CONFIG_NET_UDP
-		/* Start UDP layer */
-		ret = udp6_init();
-		if (ret) {
-			LOG_ERR("Failed to init UDP handler. Aborting net thread");
-			return;
+	/* Retried after every poll: acks and give ups free slots */
+	tx_held = false;
+
+	/* Keep data queued until connected */
+	while (connected) {
+		/* Reading data from PROTO thread */
+		pdu = pdu_queue_get(proto2net, K_NO_WAIT);
+
+		/* No message to send */
+		if (!pdu)
+			break;
+
+		/* Send message */
+		ret = transport->send(pdu->data, pdu->len);
+
+		/* All slots waiting ack: hold it, SM waits on the queue */
+		if (ret == -ENOBUFS) {
+			LOG_DBG("NET: Transport busy, msg held");
+			pdu_queue_requeue(proto2net, pdu);
+			tx_held = true;
+			break;
 		}
-	#elif CONFIG_NET_TCP
-		/* Start TCP layer */
-		ret = tcp6_init();
-		if (ret) {
-			LOG_ERR("Failed to init TCP handler. Aborting net thread");
+
+		if (ret <= 0)
+			LOG_ERR("Msg send fail (%d)", ret);
+		else
+			LOG_DBG("Sent %d bytes", ret);
+
+		net_buf_unref(pdu);
+
+		/* Queue room and buffer released: SM may be held back */
+		proto_wakeup();
+	}
+}
+
+/*
+ * Capped exponential backoff with jitter: half of the delay is random, so
+ * nodes disconnected at once (e.g. gateway restart) don't come back in
+ * lockstep.
+ */
+static s32_t backoff_delay(void)
+{
+	u32_t delay = CONFIG_KNOT_NET_BACKOFF_MIN;
+	u8_t i;
+
+	for (i = 0; i < conn_attempts && delay < CONFIG_KNOT_NET_BACKOFF_MAX;
+	     i++)
+		delay <<= 1;
+
+	delay = MIN(delay, CONFIG_KNOT_NET_BACKOFF_MAX);
+
+	return delay / 2 + sys_rand32_get() % (delay / 2 + 1);
+}
+
+static void net_thread(void)
+{
+	int ret;
+
+	ret = peer_init();
+	if (ret) {
+		LOG_ERR("No peer available. Aborting net thread");
+		return;
+	}
+
+	/* Start transport layer */
+	transport_select();
+	ret = transport->init();
+	if (ret) {
+		LOG_ERR("Failed to init %s handler", transport->name);
+		if (transport_fallback()) {
+			LOG_ERR("No transport available. Aborting net thread");
 			return;
 		}
-	#endif
-
-	memset(ipdu, 0, sizeof(ipdu));
-	connection_start();
+	}
 
 	while (1) {
 		if (!connected) {
+			/*
+			 * Spread reconnects even after the first failure.
+			 * Another peer is tried as soon as possible: only the
+			 * random part of the shortest delay is waited.
+			 */
+			#if CONFIG_KNOT_DISCOVERY
+				/* All peers failing: gateway may have moved */
+				if (conn_attempts && !peer_available())
+					peer_discover();
+			#endif
+
+			if (preferred_due())
+				transport_preferred();
+
+			if (conn_attempts && peer_available())
+				k_sleep(sys_rand32_get() %
+					(CONFIG_KNOT_NET_BACKOFF_MIN / 2 + 1));
+			else if (conn_attempts)
+				k_sleep(backoff_delay());
+
 			ret = connection_start();
 			if (ret) {
-				/* Wait before retrying connecting */
+				if (conn_attempts < UINT8_MAX)
+					conn_attempts++;
 				LOG_ERR("Waiting to retry to connecting...");
-				k_sleep(CONN_RETRY_TIME);
-				goto done;
+				continue;
 			}
 		}
-		/* Look for incoming messages */
-		#if CONFIG_NET_UDP
-			udp6_event_poll();
-		#elif CONFIG_NET_TCP
-			tcp6_event_poll();
-		#endif
-
-		ilen = 0;
-		/* Reading data from PROTO thread */
-		ret = k_pipe_get(proto2net, ipdu, sizeof(ipdu),
-				 &ilen, 0U, K_NO_WAIT);
-		if (ret != 0) {
-			LOG_ERR("Pipe read failed");
-			goto done;
-		}
 
-		/* No message to send */
-		if (ilen == 0)
-			goto done;
+		/* Sockets are only used by this thread: send from here too */
+		tx_flush();
 
-		/* Send message */
-		#if CONFIG_NET_UDP
-			ret = udp6_send(ipdu, ilen);
-		#elif CONFIG_NET_TCP
-			ret = tcp6_send(ipdu, ilen);
-		#endif
+		/* Block until incoming or outgoing data, or connection check */
+		transport->event_poll(CONFIG_KNOT_NET_POLL_TIMEOUT);
 
-		if (ret <= 0)
-			LOG_ERR("Msg send fail (%d)", ret);
-		else
-			LOG_DBG("Sent %d bytes", ret);
+		/* Requested by PROTO: peer stopped responding */
+		if (atomic_cas(&reconnect, 1, 0) && connected) {
+			LOG_WRN("NET: Restarting connection");
+			transport->stop();
+		}
 
-done:
-		k_yield();
+		/* Leave fallback backend: not a failure, no backoff */
+		if (connected && preferred_due()) {
+			LOG_INF("NET: Leaving %s transport", transport->name);
+			connected = false;
+			transport->stop();
+		}
 	}
 
-	#if CONFIG_NET_UDP
-		udp6_stop();
-	#elif CONFIG_NET_TCP
-		tcp6_stop();
-	#endif
+	transport->stop();
 }
 
-int net_start(struct k_pipe *p2n, struct k_pipe *n2p)
+int net_start(struct pdu_queue *p2n, struct pdu_queue *n2p)
 {
 	int ret;
 	LOG_DBG("NET: Start");
@@ -193,7 +423,6 @@ int net_start(struct k_pipe *p2n, struct k_pipe *n2p)
 	net2proto = n2p;
 	connected = false;
 
-
 	/* Load and set OpenThread credentials from settings */
 	#if CONFIG_SETTINGS_OT
 		ret = ot_config_init(&ot_disconn);
@@ -240,6 +469,76 @@ int net_start(struct k_pipe *p2n, struct k_pipe *n2p)
 	return 0;
 }
 
+/*
+ * Zephyr sockets can't wait on kernel objects: the socket receive queue is
+ * polled along with the TX fifo and the wakeup signal instead, then the
+ * socket events found are collected by zsock_poll() without waiting.
+ * While all RX buffers are in use, incoming data is left at the socket
+ * until one is released.
+ */
+int net_poll(struct zsock_pollfd *fds, int timeout)
+{
+	struct k_poll_event events[4];
+	struct net_context *ctx;
+	bool rx_ready;
+	int ret;
+
+	ctx = z_get_fd_obj(fds->fd, NULL, 0);
+	if (!ctx)
+		return zsock_poll(fds, 1, K_NO_WAIT);
+
+	/* Reset first: a buffer released from now on ends the wait */
+	k_poll_signal_reset(pdu_rx_signal());
+	rx_ready = pdu_rx_available();
+
+	k_poll_event_init(&events[EVENT_WAKEUP], K_POLL_TYPE_SIGNAL,
+			  K_POLL_MODE_NOTIFY_ONLY, &wakeup_signal);
+	k_poll_event_init(&events[EVENT_TX], K_POLL_TYPE_FIFO_DATA_AVAILABLE,
+			  K_POLL_MODE_NOTIFY_ONLY, &proto2net->fifo);
+	k_poll_event_init(&events[EVENT_SOCKET],
+			  K_POLL_TYPE_FIFO_DATA_AVAILABLE,
+			  K_POLL_MODE_NOTIFY_ONLY, &ctx->recv_q);
+	k_poll_event_init(&events[EVENT_RX_FREE], K_POLL_TYPE_SIGNAL,
+			  K_POLL_MODE_NOTIFY_ONLY, pdu_rx_signal());
+
+	if (!(fds->events & ZSOCK_POLLIN) || !rx_ready)
+		events[EVENT_SOCKET].type = K_POLL_TYPE_IGNORE;
+
+	if (rx_ready)
+		events[EVENT_RX_FREE].type = K_POLL_TYPE_IGNORE;
+
+	/* Held PDU is still queued: wait for the socket or a timeout */
+	if (tx_held)
+		events[EVENT_TX].type = K_POLL_TYPE_IGNORE;
+
+	k_poll(events, ARRAY_SIZE(events), timeout);
+	k_poll_signal_reset(&wakeup_signal);
+
+	ret = zsock_poll(fds, 1, K_NO_WAIT);
+
+	/* Read once a buffer is available: polled again at once */
+	if (!rx_ready)
+		fds->revents &= ~ZSOCK_POLLIN;
+
+	return ret;
+}
+
+void net_wakeup(void)
+{
+	k_poll_signal_raise(&wakeup_signal, 0);
+}
+
+bool net_is_stream(void)
+{
+	return transport && transport->stream;
+}
+
+void net_reconnect(void)
+{
+	atomic_set(&reconnect, 1);
+	net_wakeup();
+}
+
 void net_stop(void)
 {
 	LOG_DBG("NET: Stop");
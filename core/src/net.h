@@ -6,8 +6,44 @@
  * SPDX-License-Identifier: Apache-2.0
  */
 
-typedef int (*net_recv_t) (void *buf, size_t len);
+/* Ownership of the PDU buffer is passed to the callback */
+typedef int (*net_recv_t) (struct net_buf *pdu);
 typedef void (*net_close_t) (void);
 
-int net_start(struct k_pipe *p2n, struct k_pipe *n2p);
+/* Transport backend operations */
+struct net_transport {
+	const char *name;	/* Name used to select it from storage */
+	bool stream;		/* Messages sent back to back may be merged */
+	int (*init)(void);
+	int (*start)(const char *addr, net_recv_t recv, net_close_t close);
+	void (*stop)(void);
+	int (*send)(const u8_t *buf, size_t len);
+	int (*event_poll)(int timeout);
+};
+
+struct pdu_queue;
+struct zsock_pollfd;
+
+int net_start(struct pdu_queue *p2n, struct pdu_queue *n2p);
 void net_stop(void);
+
+/*
+ * Used by transports instead of zsock_poll(): returns on socket events,
+ * data queued by PROTO, wakeup or timeout.
+ */
+int net_poll(struct zsock_pollfd *fds, int timeout);
+
+/* Wake up the net thread, e.g. to process transport timers. ISR safe */
+void net_wakeup(void);
+
+/* Active transport is a byte stream: message boundaries not kept */
+bool net_is_stream(void);
+
+/* Close connection and connect again. ISR safe */
+void net_reconnect(void);
+
+/*
+ * Return true if the PDU pushes data items. Reliable if any item is sent
+ * on value change: periodic ones are replaced by the next sample.
+ */
+bool net_is_telemetry(const u8_t *pdu, size_t len, bool *reliable);
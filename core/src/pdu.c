@@ -0,0 +1,153 @@
+/* pdu.c - KNoT Application Client */
+
+/*
+ * Copyright (c) 2019, CESAR. All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr.h>
+#include <net/buf.h>
+#include <errno.h>
+#include <logging/log.h>
+
+#include "pdu.h"
+
+LOG_MODULE_DECLARE(knot, CONFIG_KNOT_LOG_LEVEL);
+
+/*
+ * Each PDU is a buffer handed over between PROTO and NET threads. TX
+ * buffers are apart: received messages waiting for PROTO can't take the
+ * buffers it needs to answer them. TX queue plus the one being sent.
+ */
+#define TX_COUNT	(CONFIG_KNOT_NET_TX_QUEUE + 1)
+#define RX_COUNT	(CONFIG_KNOT_PDU_COUNT - TX_COUNT)
+
+BUILD_ASSERT_MSG(RX_COUNT >= 2, "KNOT_PDU_COUNT too small for TX queue");
+
+static struct k_poll_signal rx_free_signal =
+	K_POLL_SIGNAL_INITIALIZER(rx_free_signal);
+static atomic_t rx_used;
+
+/* Net thread stops receiving while all RX buffers are in use */
+static void rx_destroy(struct net_buf *buf)
+{
+	net_buf_destroy(buf);
+	atomic_dec(&rx_used);
+	k_poll_signal_raise(&rx_free_signal, 0);
+}
+
+NET_BUF_POOL_DEFINE(rx_pool, RX_COUNT,
+		    PDU_HEADROOM + CONFIG_KNOT_PDU_SIZE, 0, rx_destroy);
+NET_BUF_POOL_DEFINE(tx_pool, TX_COUNT,
+		    PDU_HEADROOM + CONFIG_KNOT_PDU_SIZE, 0, NULL);
+
+static atomic_t allocs;
+static atomic_t exhausted[2];
+
+struct net_buf *pdu_alloc(enum pdu_dir dir, s32_t timeout)
+{
+	struct net_buf *buf;
+
+	buf = net_buf_alloc((dir == PDU_RX) ? &rx_pool : &tx_pool, timeout);
+	if (!buf) {
+		atomic_inc(&exhausted[dir]);
+		LOG_WRN("No %s PDU buffer available",
+			(dir == PDU_RX) ? "RX" : "TX");
+		return NULL;
+	}
+
+	atomic_inc(&allocs);
+
+	if (dir == PDU_TX)
+		net_buf_reserve(buf, PDU_HEADROOM);
+	else
+		atomic_inc(&rx_used);
+
+	return buf;
+}
+
+bool pdu_rx_available(void)
+{
+	return atomic_get(&rx_used) < RX_COUNT;
+}
+
+struct k_poll_signal *pdu_rx_signal(void)
+{
+	return &rx_free_signal;
+}
+
+void pdu_get_stats(struct pdu_stats *stats)
+{
+	stats->allocs = atomic_get(&allocs);
+	stats->exhausted[PDU_RX] = atomic_get(&exhausted[PDU_RX]);
+	stats->exhausted[PDU_TX] = atomic_get(&exhausted[PDU_TX]);
+}
+
+void pdu_queue_init(struct pdu_queue *queue, u32_t max)
+{
+	k_fifo_init(&queue->fifo);
+	atomic_clear(&queue->depth);
+	atomic_clear(&queue->peak);
+	atomic_clear(&queue->full);
+	queue->max = max;
+}
+
+bool pdu_queue_ready(struct pdu_queue *queue)
+{
+	return atomic_get(&queue->depth) < queue->max;
+}
+
+void pdu_queue_count_full(struct pdu_queue *queue)
+{
+	atomic_inc(&queue->full);
+}
+
+int pdu_queue_put(struct pdu_queue *queue, struct net_buf *pdu)
+{
+	atomic_val_t depth;
+	atomic_val_t peak;
+
+	/* Reserve room first: get may run at the same time */
+	depth = atomic_inc(&queue->depth) + 1;
+	if (depth > queue->max) {
+		atomic_dec(&queue->depth);
+		atomic_inc(&queue->full);
+		return -ENOBUFS;
+	}
+
+	do {
+		peak = atomic_get(&queue->peak);
+	} while (depth > peak && !atomic_cas(&queue->peak, peak, depth));
+
+	net_buf_put(&queue->fifo, pdu);
+
+	return 0;
+}
+
+struct net_buf *pdu_queue_get(struct pdu_queue *queue, s32_t timeout)
+{
+	struct net_buf *pdu;
+
+	pdu = net_buf_get(&queue->fifo, timeout);
+	if (pdu)
+		atomic_dec(&queue->depth);
+
+	return pdu;
+}
+
+void pdu_queue_requeue(struct pdu_queue *queue, struct net_buf *pdu)
+{
+	/* May exceed max by one: producer may have taken the room since */
+	atomic_inc(&queue->depth);
+	k_queue_prepend(&queue->fifo._queue, pdu);
+}
+
+void pdu_queue_get_stats(struct pdu_queue *queue,
+			 struct pdu_queue_stats *stats)
+{
+	stats->depth = atomic_get(&queue->depth);
+	stats->peak = atomic_get(&queue->peak);
+	stats->full = atomic_get(&queue->full);
+	stats->max = queue->max;
+}
@@ -0,0 +1,74 @@
+/* pdu.h - KNoT Application Client */
+
+/*
+ * Copyright (c) 2019, CESAR. All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * Pools of KNoT message buffers. Transports receive into them and
+ * the SM parses and builds messages in place, then buffers are handed
+ * between PROTO and NET threads through fifos without copying.
+ */
+
+/* Room for transport headers: received with the message or pushed later */
+#define PDU_HEADROOM	32
+
+enum pdu_dir {
+	PDU_RX = 0,
+	PDU_TX,
+};
+
+struct pdu_stats {
+	u32_t allocs;		/* Buffers handed out */
+	u32_t exhausted[2];	/* No buffer available, per direction */
+};
+
+/*
+ * Buffer from the pool. RX buffers hold a whole datagram: transports pull
+ * their header. TX buffers have the headroom reserved.
+ */
+struct net_buf *pdu_alloc(enum pdu_dir dir, s32_t timeout);
+
+void pdu_get_stats(struct pdu_stats *stats);
+
+/* Return false if all RX buffers are in use */
+bool pdu_rx_available(void);
+
+/* Raised whenever an RX buffer is released. Reset by the waiter */
+struct k_poll_signal *pdu_rx_signal(void);
+
+/* Bounded fifo of PDUs: producers see it full instead of queuing more */
+struct pdu_queue {
+	struct k_fifo fifo;	/* First: may be polled as a fifo */
+	atomic_t depth;		/* Buffers queued */
+	atomic_t peak;		/* Highest depth seen */
+	atomic_t full;		/* Times found full */
+	u32_t max;		/* Depth limit */
+};
+
+struct pdu_queue_stats {
+	u32_t depth;
+	u32_t peak;
+	u32_t full;
+	u32_t max;
+};
+
+void pdu_queue_init(struct pdu_queue *queue, u32_t max);
+
+/* Return false if there is no room left */
+bool pdu_queue_ready(struct pdu_queue *queue);
+
+/* Count a producer held back by a full queue */
+void pdu_queue_count_full(struct pdu_queue *queue);
+
+/* Queue PDU. If queue is full, -ENOBUFS and caller keeps the buffer */
+int pdu_queue_put(struct pdu_queue *queue, struct net_buf *pdu);
+struct net_buf *pdu_queue_get(struct pdu_queue *queue, s32_t timeout);
+
+/* Put back at the head a PDU just taken: never fails */
+void pdu_queue_requeue(struct pdu_queue *queue, struct net_buf *pdu);
+
+void pdu_queue_get_stats(struct pdu_queue *queue,
+			 struct pdu_queue_stats *stats);
@@ -0,0 +1,306 @@
+/* peer.c - KNoT Application Client */
+
+/*
+ * Copyright (c) 2019, CESAR. All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * Peer (gateway) list. It is stored as "prio@addr" entries separated by
+ * ',', e.g. "0@fd00::1,0@fd00::2,1@fd00::3", lower priority values first.
+ * If there is no list, the single peer stored by the setup app is used.
+ * A peer that fails is held down for a time doubling at each failure.
+ * Among peers not held down with the best priority, the one with fewer
+ * failures is selected. Ties go to the lowest connect latency or, to
+ * spread load, to the peer picked by the device id.
+ * With discovery enabled, the gateway found by name is added to the list
+ * and cached at storage. It is looked up again when all peers fail.
+ */
+
+#include <zephyr.h>
+#include <logging/log.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "storage.h"
+#include "discovery.h"
+#include "peer.h"
+
+LOG_MODULE_DECLARE(knot, CONFIG_KNOT_LOG_LEVEL);
+
+#define PEER_LIST_LEN		128
+#define HOLD_SHIFT_MAX		6	/* Hold down up to 64 times the base */
+
+struct peer {
+	char addr[PEER_ADDR_LEN];
+	u8_t prio;		/* Lower value first */
+	u8_t failures;		/* Consecutive failures */
+	u32_t latency;		/* Smoothed connect latency (ms) */
+	s64_t hold_until;	/* Uptime it may be selected again */
+	bool round_failed;	/* Failed in the current round */
+};
+
+static struct peer peers[CONFIG_KNOT_PEER_MAX];
+static u8_t peer_count;
+static struct peer *current;
+static struct peer *discovered;
+
+static struct peer *peer_add(const char *entry, size_t len)
+{
+	struct peer *peer;
+	const char *at;
+
+	if (peer_count >= ARRAY_SIZE(peers)) {
+		LOG_WRN("Peer list full");
+		return NULL;
+	}
+
+	peer = &peers[peer_count];
+	memset(peer, 0, sizeof(*peer));
+
+	/* Optional priority */
+	at = memchr(entry, '@', len);
+	if (at) {
+		peer->prio = strtoul(entry, NULL, 10);
+		len -= at + 1 - entry;
+		entry = at + 1;
+	}
+
+	if (len == 0 || len >= sizeof(peer->addr)) {
+		LOG_WRN("Invalid peer");
+		return NULL;
+	}
+
+	memcpy(peer->addr, entry, len);
+	peer->addr[len] = '\0';
+	peer_count++;
+
+	return peer;
+}
+
+#if CONFIG_KNOT_DISCOVERY
+int peer_discover(void)
+{
+	char addr[PEER_ADDR_LEN];
+	int rc;
+
+	rc = discovery_resolve(addr, sizeof(addr));
+	if (rc)
+		return rc;
+
+	if (!discovered) {
+		discovered = peer_add(addr, strlen(addr));
+		if (!discovered)
+			return -ENOMEM;
+	} else if (strcmp(discovered->addr, addr) == 0) {
+		/* Same gateway: give it another chance */
+		discovered->hold_until = 0;
+		return 0;
+	} else {
+		strcpy(discovered->addr, addr);
+		discovered->failures = 0;
+		discovered->latency = 0;
+		discovered->hold_until = 0;
+	}
+
+	/* Cache so next boot doesn't wait for discovery */
+	rc = storage_write(STORAGE_PEER_CACHE, addr, sizeof(addr));
+
+	return (rc < 0) ? rc : 0;
+}
+#endif
+
+int peer_init(void)
+{
+	char list[PEER_LIST_LEN];
+	char *entry;
+	char *end;
+	int rc;
+
+	peer_count = 0;
+	current = NULL;
+	discovered = NULL;
+
+	rc = storage_read(STORAGE_PEER_LIST, list, sizeof(list) - 1);
+	if (rc <= 0)
+		rc = storage_read(STORAGE_PEER_IPV6, list, sizeof(list) - 1);
+
+	if (rc > 0) {
+		list[rc] = '\0';
+
+		for (entry = list; entry; entry = end ? end + 1 : NULL) {
+			end = strchr(entry, ',');
+			peer_add(entry, end ? end - entry : strlen(entry));
+		}
+	}
+
+#if CONFIG_KNOT_DISCOVERY
+	/* Gateway discovered before or discover it now */
+	rc = storage_read(STORAGE_PEER_CACHE, list, PEER_ADDR_LEN - 1);
+	if (rc > 0) {
+		list[rc] = '\0';
+		discovered = peer_add(list, strlen(list));
+	} else if (peer_discover()) {
+		/* Looked up again while connecting */
+		LOG_WRN("Gateway not found yet");
+		return 0;
+	}
+#endif
+
+	if (peer_count == 0) {
+		LOG_ERR("Failed to read Peer's IPv6");
+		return -ENOENT;
+	}
+
+	LOG_INF("%d peer(s) found", peer_count);
+
+	return 0;
+}
+
+/* Less than zero if peer 'a' is better than 'b' */
+static int peer_cmp(const struct peer *a, const struct peer *b)
+{
+	if (a->prio != b->prio)
+		return a->prio - b->prio;
+
+	if (a->failures != b->failures)
+		return a->failures - b->failures;
+
+#if CONFIG_KNOT_PEER_SPREAD
+	return 0;
+#else
+	return (a->latency > b->latency) - (a->latency < b->latency);
+#endif
+}
+
+/* Same device picks the same peer among equivalent ones */
+static u8_t device_pick(u8_t count)
+{
+	u64_t devid = 0;
+
+	storage_read(STORAGE_CRED_DEVID, &devid, sizeof(devid));
+
+	return (u32_t) (devid ^ (devid >> 32)) % count;
+}
+
+const char *peer_select(void)
+{
+	s64_t now = k_uptime_get();
+	struct peer *best = NULL;
+	u8_t ties = 0;
+	u8_t pick;
+	u8_t i;
+
+	if (peer_count == 0)
+		return NULL;
+
+	for (i = 0; i < peer_count; i++) {
+		if (peers[i].hold_until > now)
+			continue;
+
+		if (!best || peer_cmp(&peers[i], best) < 0) {
+			best = &peers[i];
+			ties = 1;
+		} else if (peer_cmp(&peers[i], best) == 0) {
+			ties++;
+		}
+	}
+
+	/* Spread devices across equivalent peers */
+	if (ties > 1) {
+		pick = device_pick(ties);
+		for (i = 0; i < peer_count; i++) {
+			if (peers[i].hold_until > now ||
+			    peer_cmp(&peers[i], best) != 0)
+				continue;
+			if (pick-- == 0) {
+				best = &peers[i];
+				break;
+			}
+		}
+	}
+
+	/* All held down: the one released first */
+	if (!best) {
+		best = &peers[0];
+		for (i = 1; i < peer_count; i++)
+			if (peers[i].hold_until < best->hold_until)
+				best = &peers[i];
+	}
+
+	current = best;
+	LOG_DBG("Peer %s selected", current->addr);
+
+	return current->addr;
+}
+
+bool peer_available(void)
+{
+	s64_t now = k_uptime_get();
+	u8_t i;
+
+	for (i = 0; i < peer_count; i++)
+		if (peers[i].hold_until <= now)
+			return true;
+
+	return false;
+}
+
+void peer_connected(u32_t latency)
+{
+	if (!current)
+		return;
+
+	current->failures = 0;
+	current->hold_until = 0;
+	peer_round_start();
+
+	/* Moving average with 1/8 weight of the new sample */
+	if (current->latency == 0)
+		current->latency = latency;
+	else
+		current->latency = (7 * current->latency + latency) / 8;
+}
+
+void peer_failed(void)
+{
+	u8_t shift;
+
+	if (!current)
+		return;
+
+	if (current->failures < UINT8_MAX)
+		current->failures++;
+
+	current->round_failed = true;
+
+	shift = MIN(current->failures - 1, HOLD_SHIFT_MAX);
+	current->hold_until = k_uptime_get() +
+			      ((s64_t) CONFIG_KNOT_PEER_HOLD_DOWN << shift);
+
+	LOG_WRN("Peer %s failed %d time(s)", current->addr,
+		current->failures);
+}
+
+void peer_round_start(void)
+{
+	u8_t i;
+
+	for (i = 0; i < peer_count; i++)
+		peers[i].round_failed = false;
+}
+
+bool peer_round_failed(void)
+{
+	u8_t i;
+
+	for (i = 0; i < peer_count; i++)
+		if (!peers[i].round_failed)
+			return false;
+
+	peer_round_start();
+
+	return true;
+}
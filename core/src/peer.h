@@ -0,0 +1,33 @@
+/* peer.h - KNoT Application Client */
+
+/*
+ * Copyright (c) 2019, CESAR. All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/* Gateways the thing may connect to */
+
+#define PEER_ADDR_LEN	40
+
+int peer_init(void);
+
+/* Address of the best peer to connect to or NULL if none */
+const char *peer_select(void);
+
+/* Any peer not held down after failing */
+bool peer_available(void);
+
+/* Look up the gateway by name and add or update it */
+int peer_discover(void);
+
+/* Result of connecting to the peer selected */
+void peer_connected(u32_t latency);
+void peer_failed(void);
+
+/*
+ * Rounds: every peer tried once, e.g. on the transport in use. Return
+ * true if all peers failed in the current round, which then restarts.
+ */
+void peer_round_start(void);
+bool peer_round_failed(void);
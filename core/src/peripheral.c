@@ -32,6 +32,7 @@ LOG_MODULE_DECLARE(knot, CONFIG_KNOT_LOG_LEVEL);
 #include <gpio.h>
 
 #include "peripheral.h"
+#include "proto.h"
 
 static struct device *rst_gpio;
 static struct device *status_gpio;
@@ -50,6 +51,7 @@ static s64_t last_toggle_time;
 static void set_reset(struct k_timer *timer_id)
 {
 	rst_flag = true;
+	proto_wakeup();
 }
 
 static void rst_btn_edge(struct device *rst_gpio,
@@ -167,4 +169,13 @@ bool peripheral_flag_status(void)
 	return false;
 }
 
+/* Uptime of next led toggle: -1 if not toggling */
+s64_t peripheral_get_next_deadline(void)
+{
+	if (toggle_led_period < 0)
+		return -1;
+
+	return last_toggle_time + toggle_led_period;
+}
+
 #endif
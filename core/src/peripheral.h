@@ -28,3 +28,5 @@ bool peripheral_get_reset(void);
 void peripheral_set_status_period(s64_t status);
 
 bool peripheral_flag_status(void);
+
+s64_t peripheral_get_next_deadline(void);
@@ -26,6 +26,8 @@
 #include "knot.h"
 #include "sm.h"
 #include "proto.h"
+#include "net.h"
+#include "pdu.h"
 #include "peripheral.h"
 #include "clear.h"
 
@@ -33,11 +35,26 @@ LOG_MODULE_DECLARE(knot, CONFIG_KNOT_LOG_LEVEL);
 
 static struct k_thread rx_thread_data;
 static K_THREAD_STACK_DEFINE(rx_stack, 1024);
-static struct k_pipe *proto2net;
-static struct k_pipe *net2proto;
+static struct pdu_queue *proto2net;
+static struct pdu_queue *net2proto;
+static bool tx_held;		/* SM held back: TX queue full */
 
 extern struct k_sem conn_sem;
 
+/*
+ * Wakes up the proto thread: SM timeouts, connection changes and app
+ * notifications. Incoming data is signaled by the NET to PROTO fifo.
+ */
+static struct k_poll_signal wakeup_signal =
+	K_POLL_SIGNAL_INITIALIZER(wakeup_signal);
+
+enum {
+	EVENT_WAKEUP,
+	EVENT_RX,
+};
+
+static struct k_poll_event events[2];
+
 /*
  * Handle connection and disconnection events. Return true if connected.
  */
@@ -65,14 +82,93 @@ done:
 	return connected;
 }
 
-static void proto_thread(void)
+/* Earliest of two deadlines: negative ones are not set */
+static s64_t earliest(s64_t a, s64_t b)
+{
+	if (a < 0 || (b >= 0 && b < a))
+		return b;
+
+	return a;
+}
+
+/* Time to wait for events: next loop() call, led toggle or SM deadline */
+static s32_t next_timeout(s64_t next_loop)
+{
+	s64_t deadline;
+	s64_t now;
+
+	deadline = earliest(next_loop, sm_get_next_deadline());
+	deadline = earliest(deadline, peripheral_get_next_deadline());
+
+	/* Nothing scheduled: sleep until an event happens */
+	if (deadline < 0)
+		return K_FOREVER;
+
+	now = k_uptime_get();
+	if (deadline <= now)
+		return K_NO_WAIT;
+
+	return (s32_t) (deadline - now);
+}
+
+/*
+ * Run SM until there is nothing left to receive or to send. Return true
+ * if it was held back: no room to send its output.
+ */
+static bool run_sm(void)
 {
-	/* Considering KNOT Max MTU 128 */
-	u8_t ipdu[128];
-	u8_t opdu[128];
+	struct net_buf *ibuf;
+	struct net_buf *obuf;
 	size_t olen;
-	size_t ilen;
-	int ret;
+
+	do {
+		/*
+		 * Backpressure: SM holds its next message until NET drains
+		 * the queue and wakes this thread up again.
+		 */
+		if (!pdu_queue_ready(proto2net)) {
+			if (!tx_held)
+				pdu_queue_count_full(proto2net);
+			tx_held = true;
+			return true;
+		}
+
+		/* Output PDU is built in place: stop if none available */
+		obuf = pdu_alloc(PDU_TX, K_NO_WAIT);
+		if (!obuf)
+			return true;
+
+		tx_held = false;
+
+		/* Reading data from NET thread */
+		ibuf = pdu_queue_get(net2proto, K_NO_WAIT);
+
+		olen = sm_run(ibuf ? ibuf->data : NULL, ibuf ? ibuf->len : 0,
+			      obuf->data, net_buf_tailroom(obuf));
+
+		if (ibuf)
+			net_buf_unref(ibuf);
+
+		if (olen == 0) {
+			net_buf_unref(obuf);
+			continue;
+		}
+
+		/* Sending data to NET thread: room checked above */
+		net_buf_add(obuf, olen);
+		if (pdu_queue_put(proto2net, obuf)) {
+			LOG_ERR("TX queue full: msg dropped");
+			net_buf_unref(obuf);
+		}
+	} while (ibuf || olen != 0);
+
+	return false;
+}
+
+static void proto_thread(void)
+{
+	s64_t next_loop;
+	s64_t now;
 	bool reset;
 
 	/* Initializing KNoT peripherals control */
@@ -85,9 +181,26 @@ static void proto_thread(void)
 	/* Calling KNoT app: setup() */
 	setup();
 
+	k_poll_event_init(&events[EVENT_WAKEUP], K_POLL_TYPE_SIGNAL,
+			  K_POLL_MODE_NOTIFY_ONLY, &wakeup_signal);
+	k_poll_event_init(&events[EVENT_RX], K_POLL_TYPE_FIFO_DATA_AVAILABLE,
+			  K_POLL_MODE_NOTIFY_ONLY, &net2proto->fifo);
+
+	/*
+	 * Period 0: loop() runs whenever the thread wakes up, but never
+	 * wakes it. Apps driven by notifications don't wake it every period.
+	 */
+	next_loop = CONFIG_KNOT_LOOP_PERIOD ? k_uptime_get() : -1;
+
 	while (1) {
-		/* Calling KNoT app: loop() */
-		loop();
+		/* Calling KNoT app: loop() at every period */
+		now = k_uptime_get();
+		if (next_loop < 0) {
+			loop();
+		} else if (now >= next_loop) {
+			loop();
+			next_loop = now + CONFIG_KNOT_LOOP_PERIOD;
+		}
 
 		peripheral_flag_status();
 
@@ -105,30 +218,36 @@ static void proto_thread(void)
 		/* Ignore net and SM if disconnected */
 		if (check_connection() == false) {
 			peripheral_set_status_period(STATUS_DISCONN_PERIOD);
-			goto done;
+			/* Incoming data is only handled while connected */
+			events[EVENT_RX].type = K_POLL_TYPE_IGNORE;
+			/* Keep sampling: changes are sent once reconnected */
+			sm_poll_offline();
+			goto wait;
 		}
 
-		ilen = 0;
-		memset(&ipdu, 0, sizeof(ipdu));
-		/* Reading data from NET thread */
-		ret = k_pipe_get(net2proto, ipdu, sizeof(ipdu),
-				 &ilen, 0U, K_NO_WAIT);
+		/* Held: input is left queued until NET wakes this thread */
+		if (run_sm())
+			events[EVENT_RX].type = K_POLL_TYPE_IGNORE;
+		else
+			events[EVENT_RX].type = K_POLL_TYPE_FIFO_DATA_AVAILABLE;
 
-		olen = sm_run(ipdu, ilen, opdu, sizeof(opdu));
+		/* Half-open connection: restart it */
+		if (sm_get_peer_lost())
+			net_reconnect();
 
-		/* Sending data to NET thread */
-		if (olen != 0)
-			k_pipe_put(proto2net, opdu, olen,
-				   &olen, olen, K_NO_WAIT);
+wait:
+		/* Sleep until an event happens or a deadline is reached */
+		k_poll(events, ARRAY_SIZE(events), next_timeout(next_loop));
 
-done:
-		k_yield();
+		k_poll_signal_reset(&wakeup_signal);
+		events[EVENT_WAKEUP].state = K_POLL_STATE_NOT_READY;
+		events[EVENT_RX].state = K_POLL_STATE_NOT_READY;
 	}
 
 	sm_stop();
 }
 
-int proto_start(struct k_pipe *p2n, struct k_pipe *n2p)
+int proto_start(struct pdu_queue *p2n, struct pdu_queue *n2p)
 {
 	LOG_DBG("PROTO: Start");
 
@@ -143,6 +262,11 @@ int proto_start(struct k_pipe *p2n, struct k_pipe *n2p)
 	return 0;
 }
 
+void proto_wakeup(void)
+{
+	k_poll_signal_raise(&wakeup_signal, 0);
+}
+
 void proto_stop(void)
 {
 	LOG_DBG("PROTO: Stop");
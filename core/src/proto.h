@@ -6,6 +6,11 @@
  * SPDX-License-Identifier: Apache-2.0
  */
 
-int proto_start(struct k_pipe *p2n, struct k_pipe *n2p);
+struct pdu_queue;
+
+int proto_start(struct pdu_queue *p2n, struct pdu_queue *n2p);
 
 void proto_stop(void);
+
+/* Wake up proto thread to handle new events. ISR safe */
+void proto_wakeup(void);
@@ -15,6 +15,7 @@
 #include <knot/knot_types.h>
 #include "msg.h"
 #include "proxy.h"
+#include "proto.h"
 #include "knot.h"
 
 LOG_MODULE_DECLARE(knot, CONFIG_KNOT_LOG_LEVEL);
@@ -57,8 +58,8 @@ static struct knot_proxy {
 	/* KNoT identifier */
 	u8_t			id;
 
-	/* Schema values */
-	knot_schema		schema;
+	/* Schema values: in flash for items from KNOT_DATA_DEFINE() */
+	const knot_schema	*schema;
 
 	/* Data values */
 	knot_value_type		value;
@@ -66,34 +67,267 @@ static struct knot_proxy {
 	/* Watched/Controlled variable */
 	void			*target;
 	size_t			 target_len;
+	u8_t			sync; /* enum knot_data_sync */
+	atomic_t		seq; /* Odd while written. Bit 1: double half */
 
 	/* Control variable to send data */
-	bool			send; /* 'value' must be sent */
 	bool			wait_resp; /* Will send 'value' until resp */
 	bool 			upper_flag; /* Upper limit crossed */
 	bool 			lower_flag; /* Lower limit crossed */
 	u8_t			olen; /* Amount to send / Output: temporary */
+	u8_t			gen; /* Bumped whenever 'value' changes */
 
 	/* Config values */
 	knot_config		config;
 
 	/* Time values */
-	u32_t			last_timeout;
+	s64_t			deadline; /* Next periodic send (uptime ms) */
+	u8_t			heap_idx; /* Index at deadline heap */
+	bool			timeout; /* Deadline reached */
 
 	knot_callback_t		read_cb; /* Poll for local changes */
 	knot_callback_t		write_cb; /* Report new value to user app */
+
+	/*
+	 * Last value given by knot_data_notify_value(): guarded by irq lock.
+	 * Kept for periodic reads until the item is written by the cloud.
+	 */
+	knot_value_type		notify_value;
+	bool			notify_has_value;
 } proxy_pool[CONFIG_KNOT_THING_DATA_MAX];
 
 static u8_t last_id = 0xff;
 
+#define MAP_WORDS	(1 + (CONFIG_KNOT_THING_DATA_MAX - 1) / ATOMIC_BITS)
+
+/* Snapshot attempts before giving up until next read */
+#define SNAPSHOT_TRIES	4
+
+/* Items that have a value waiting to be sent: 'value' must be sent */
+static ATOMIC_DEFINE(pending_map, CONFIG_KNOT_THING_DATA_MAX);
+
+/* Items with any event flag set: must be sampled to detect events */
+static ATOMIC_DEFINE(watch_map, CONFIG_KNOT_THING_DATA_MAX);
+
+/* Items notified by the app since last poll. Set from any context */
+static ATOMIC_DEFINE(notify_map, CONFIG_KNOT_THING_DATA_MAX);
+
+/* Items whose changes are notified by the app: never sampled */
+static ATOMIC_DEFINE(push_map, CONFIG_KNOT_THING_DATA_MAX);
+
+/* Uptime to sample watched items not notified by the app again */
+static s64_t next_sample;
+
+/* Find first bit set at 'map' starting from 'from' and wrapping around */
+static int find_next_set(atomic_t *map, u8_t from)
+{
+	atomic_val_t word;
+	int first;
+	int i;
+	int n;
+
+	if (from >= CONFIG_KNOT_THING_DATA_MAX)
+		from = 0;
+
+	first = from / ATOMIC_BITS;
+
+	/* Last iteration goes back to the first word for the wrapped bits */
+	for (n = 0; n <= MAP_WORDS; n++) {
+		i = (first + n) % MAP_WORDS;
+		word = atomic_get(&map[i]);
+
+		if (n == 0)
+			word &= ~BIT_MASK(from % ATOMIC_BITS);
+		else if (n == MAP_WORDS)
+			word &= BIT_MASK(from % ATOMIC_BITS);
+
+		if (word)
+			return (i * ATOMIC_BITS) + find_lsb_set(word) - 1;
+	}
+
+	return -ENOENT;
+}
+
+/*
+ * Deadline scheduler: min-heap of periodic items (KNOT_EVT_FLAG_TIME)
+ * keyed by next-due time, so only items whose deadline is reached are
+ * read and the time to the next periodic send is known in advance.
+ */
+static u8_t deadline_heap[CONFIG_KNOT_THING_DATA_MAX];
+static u8_t heap_len;
+
+#define heap_deadline(i)	(proxy_pool[deadline_heap[i]].deadline)
+
+static void heap_swap(u8_t a, u8_t b)
+{
+	u8_t id = deadline_heap[a];
+
+	deadline_heap[a] = deadline_heap[b];
+	deadline_heap[b] = id;
+	proxy_pool[deadline_heap[a]].heap_idx = a;
+	proxy_pool[deadline_heap[b]].heap_idx = b;
+}
+
+static void heap_sift_up(u8_t i)
+{
+	u8_t parent;
+
+	while (i > 0) {
+		parent = (i - 1) / 2;
+		if (heap_deadline(parent) <= heap_deadline(i))
+			break;
+		heap_swap(i, parent);
+		i = parent;
+	}
+}
+
+static void heap_sift_down(u8_t i)
+{
+	u8_t child;
+
+	while ((child = (2 * i) + 1) < heap_len) {
+		if (child + 1 < heap_len &&
+		    heap_deadline(child + 1) < heap_deadline(child))
+			child++;
+		if (heap_deadline(i) <= heap_deadline(child))
+			break;
+		heap_swap(i, child);
+		i = child;
+	}
+}
+
+static void heap_remove(struct knot_proxy *proxy)
+{
+	u8_t i = proxy->heap_idx;
+
+	if (i == 0xff)
+		return;
+
+	proxy->heap_idx = 0xff;
+	heap_len--;
+	if (i == heap_len)
+		return;
+
+	/* Move last item to the hole and restore heap order */
+	deadline_heap[i] = deadline_heap[heap_len];
+	proxy_pool[deadline_heap[i]].heap_idx = i;
+	heap_sift_up(i);
+	heap_sift_down(proxy_pool[deadline_heap[i]].heap_idx);
+}
+
+static void heap_insert(struct knot_proxy *proxy, s64_t deadline)
+{
+	heap_remove(proxy);
+
+	proxy->deadline = deadline;
+	proxy->heap_idx = heap_len;
+	deadline_heap[heap_len] = proxy->id;
+	heap_len++;
+	heap_sift_up(proxy->heap_idx);
+}
+
+/* Flag item at the top of the heap as timed out and schedule next period */
+static void heap_schedule_next(s64_t now)
+{
+	struct knot_proxy *proxy = &proxy_pool[deadline_heap[0]];
+	s64_t period;
+
+	proxy->timeout = true;
+
+	/* Keep the period phase unless periods were missed */
+	period = (s64_t) proxy->config.time_sec * MSEC_PER_SEC;
+	proxy->deadline += period;
+	if (proxy->deadline <= now)
+		proxy->deadline = now + period;
+
+	heap_sift_down(0);
+}
+
+static void set_pending(struct knot_proxy *proxy, bool pending)
+{
+	if (pending)
+		atomic_set_bit(pending_map, proxy->id);
+	else
+		atomic_clear_bit(pending_map, proxy->id);
+}
+
+/* Schedule item as set by its config */
+static void apply_config(struct knot_proxy *proxy)
+{
+	u8_t event_flags = proxy->config.event_flags;
+
+	/* Periodic items are owned by the deadline scheduler */
+	proxy->timeout = false;
+	if (event_flags & KNOT_EVT_FLAG_TIME)
+		heap_insert(proxy, k_uptime_get() +
+			    (s64_t) proxy->config.time_sec * MSEC_PER_SEC);
+	else
+		heap_remove(proxy);
+
+	/* Only items watching value events need to be sampled */
+	if (event_flags & (KNOT_EVT_FLAG_CHANGE |
+			   KNOT_EVT_FLAG_UPPER_THRESHOLD |
+			   KNOT_EVT_FLAG_LOWER_THRESHOLD))
+		atomic_set_bit(watch_map, proxy->id);
+	else
+		atomic_clear_bit(watch_map, proxy->id);
+}
+
+/* Items from KNOT_DATA_DEFINE(): checked at build time */
+extern const struct knot_data_desc _knot_data_list_start[];
+extern const struct knot_data_desc _knot_data_list_end[];
+
+static void load_defined(void)
+{
+	const struct knot_data_desc *desc;
+	struct knot_proxy *proxy;
+
+	for (desc = _knot_data_list_start; desc < _knot_data_list_end;
+	     desc++) {
+		proxy = &proxy_pool[desc->id];
+
+		/* Id is only known to be unique at runtime */
+		if (proxy->id != 0xff) {
+			LOG_ERR("Define for ID %d failed: "
+				"Id already registered", desc->id);
+			continue;
+		}
+
+		proxy->id = desc->id;
+		proxy->schema = &desc->schema;
+		proxy->target = desc->target;
+		proxy->target_len = desc->target_len;
+		proxy->read_cb = desc->read_cb;
+		proxy->write_cb = desc->write_cb;
+		memcpy(&proxy->config, &desc->config, sizeof(proxy->config));
+		apply_config(proxy);
+
+		if (desc->id > last_id || last_id == 0xff)
+			last_id = desc->id;
+	}
+}
+
 void proxy_init(void)
 {
 	int i;
 
 	memset(proxy_pool, 0, sizeof(proxy_pool));
 
-	for (i = 0; (i < sizeof(proxy_pool) / sizeof(struct knot_proxy)); i++)
+	for (i = 0; (i < sizeof(proxy_pool) / sizeof(struct knot_proxy)); i++) {
 		proxy_pool[i].id = 0xff;
+		proxy_pool[i].heap_idx = 0xff;
+	}
+
+	heap_len = 0;
+
+	for (i = 0; i < MAP_WORDS; i++) {
+		atomic_clear(&pending_map[i]);
+		atomic_clear(&watch_map[i]);
+		atomic_clear(&notify_map[i]);
+		atomic_clear(&push_map[i]);
+	}
+
+	load_defined();
 }
 
 void proxy_stop(void)
@@ -101,12 +335,29 @@ void proxy_stop(void)
 
 }
 
+#if CONFIG_KNOT_DATA_REGISTER
+
+/* Schemas of items registered at runtime */
+static knot_schema schema_pool[CONFIG_KNOT_THING_DATA_MAX];
+
 int knot_data_register(u8_t id, const char *name,
 		       u16_t type_id, u8_t value_type, u8_t unit,
 		       void *target, size_t target_len,
 		       knot_callback_t write_cb, knot_callback_t read_cb)
+{
+	return knot_data_register_sync(id, name, type_id, value_type, unit,
+				       target, target_len, write_cb, read_cb,
+				       KNOT_DATA_SYNC_NONE);
+}
+
+int knot_data_register_sync(u8_t id, const char *name,
+			    u16_t type_id, u8_t value_type, u8_t unit,
+			    void *target, size_t target_len,
+			    knot_callback_t write_cb, knot_callback_t read_cb,
+			    enum knot_data_sync sync)
 {
 	struct knot_proxy *proxy;
+	knot_schema *schema;
 
 	/* Out of index? */
 	if (id >= CONFIG_KNOT_THING_DATA_MAX) {
@@ -166,6 +417,12 @@ int knot_data_register(u8_t id, const char *name,
 		return -1;
 	}
 
+	if (sync > KNOT_DATA_SYNC_DOUBLE) {
+		LOG_ERR("Register for ID %d failed: "
+			"Invalid sync mode", id);
+		return -1;
+	}
+
 	/* Basic field validation */
 	if (knot_schema_is_valid(type_id, value_type, unit) != 0 || !name) {
 		LOG_ERR("Register for ID %d failed: "
@@ -175,20 +432,24 @@ int knot_data_register(u8_t id, const char *name,
 
 	proxy = &proxy_pool[id];
 
+	schema = &schema_pool[id];
+	schema->type_id = type_id;
+	schema->unit = unit;
+	schema->value_type = value_type;
+	strncpy(schema->name, name,
+		MIN(KNOT_PROTOCOL_DATA_NAME_LEN, strlen(name)));
+
 	proxy->id = id;
-	proxy->schema.type_id = type_id;
-	proxy->schema.unit = unit;
-	proxy->schema.value_type = value_type;
+	proxy->schema = schema;
 	proxy->target = target;
 	proxy->target_len = target_len;
-	proxy->send = false;
+	proxy->sync = sync;
+	atomic_clear(&proxy->seq);
+	set_pending(proxy, false);
 	proxy->upper_flag = false;
 	proxy->lower_flag = false;
 	proxy->olen = 0;
 
-	strncpy(proxy->schema.name, name,
-		MIN(KNOT_PROTOCOL_DATA_NAME_LEN, strlen(name)));
-
 	/* Set default config */
 	proxy->config.event_flags = KNOT_EVT_FLAG_NONE;
 
@@ -201,6 +462,8 @@ int knot_data_register(u8_t id, const char *name,
 	return id;
 }
 
+#endif /* CONFIG_KNOT_DATA_REGISTER */
+
 bool knot_data_config(u8_t id, ...)
 {
 	va_list event_args;
@@ -245,19 +508,19 @@ bool knot_data_config(u8_t id, ...)
 			event_flags |= KNOT_EVT_FLAG_TIME;
 			break;
 		case KNOT_EVT_FLAG_UPPER_THRESHOLD:
-			if(proxy->schema.value_type == KNOT_VALUE_TYPE_INT)
+			if(proxy->schema->value_type == KNOT_VALUE_TYPE_INT)
 				upper_limit.val_i = (s32_t) va_arg(event_args,
 							 int);
-			if(proxy->schema.value_type == KNOT_VALUE_TYPE_FLOAT)
+			if(proxy->schema->value_type == KNOT_VALUE_TYPE_FLOAT)
 				upper_limit.val_f = (float) va_arg(event_args,
 							 double);
 			event_flags |= KNOT_EVT_FLAG_UPPER_THRESHOLD;
 			break;
 		case KNOT_EVT_FLAG_LOWER_THRESHOLD:
-			if(proxy->schema.value_type == KNOT_VALUE_TYPE_INT)
+			if(proxy->schema->value_type == KNOT_VALUE_TYPE_INT)
 				lower_limit.val_i = (s32_t) va_arg(event_args,
 							 int);
-			if(proxy->schema.value_type == KNOT_VALUE_TYPE_FLOAT)
+			if(proxy->schema->value_type == KNOT_VALUE_TYPE_FLOAT)
 				lower_limit.val_f = (float) va_arg(event_args,
 							 double);
 			event_flags |= KNOT_EVT_FLAG_LOWER_THRESHOLD;
@@ -272,7 +535,7 @@ bool knot_data_config(u8_t id, ...)
 	} while(event);
 	va_end(event_args);
 
-	if (knot_config_is_valid(event_flags, proxy->schema.value_type,
+	if (knot_config_is_valid(event_flags, proxy->schema->value_type,
 				 timeout_sec, &lower_limit, &upper_limit) != 0) {
 		LOG_ERR("Config for ID %d failed: "
 			"Invalid config values", id);
@@ -292,9 +555,111 @@ bool knot_data_config(u8_t id, ...)
 	proxy->config.event_flags = event_flags;
 	proxy->config.time_sec = timeout_sec;
 
+	apply_config(proxy);
+
 	return true;
 }
 
+int knot_data_notify(u8_t id)
+{
+	if (id >= CONFIG_KNOT_THING_DATA_MAX || proxy_pool[id].id == 0xff)
+		return -EINVAL;
+
+	atomic_set_bit(push_map, id);
+	atomic_set_bit(notify_map, id);
+
+	/* Read it at the next SM run instead of waiting the next scan */
+	proto_wakeup();
+
+	return 0;
+}
+
+int knot_data_notify_value(u8_t id, const void *value, size_t len)
+{
+	struct knot_proxy *proxy;
+	unsigned int key;
+
+	if (id >= CONFIG_KNOT_THING_DATA_MAX)
+		return -EINVAL;
+
+	proxy = &proxy_pool[id];
+
+	if (proxy->id == 0xff || !value || len > proxy->target_len ||
+	    (len < proxy->target_len &&
+	     proxy->schema->value_type != KNOT_VALUE_TYPE_RAW))
+		return -EINVAL;
+
+	/* Replaces the last notified value: also used by periodic reads */
+	key = irq_lock();
+	memset(&proxy->notify_value, 0, sizeof(proxy->notify_value));
+	memcpy(&proxy->notify_value, value, len);
+	proxy->notify_has_value = true;
+	irq_unlock(key);
+
+	return knot_data_notify(id);
+}
+
+/* Double buffer items: half published by 'seq' */
+static u8_t *target_half(struct knot_proxy *proxy, atomic_val_t seq)
+{
+	if (proxy->sync != KNOT_DATA_SYNC_DOUBLE)
+		return proxy->target;
+
+	return (u8_t *) proxy->target + (((seq >> 1) & 1) * proxy->target_len);
+}
+
+void *knot_data_write_begin(u8_t id)
+{
+	struct knot_proxy *proxy;
+	atomic_val_t seq;
+	u8_t *next;
+
+	if (id >= CONFIG_KNOT_THING_DATA_MAX || proxy_pool[id].id == 0xff)
+		return NULL;
+
+	proxy = &proxy_pool[id];
+
+	switch (proxy->sync) {
+	case KNOT_DATA_SYNC_SEQLOCK:
+		/* Odd: readers retry until write ends */
+		atomic_inc(&proxy->seq);
+		compiler_barrier();
+		return proxy->target;
+	case KNOT_DATA_SYNC_DOUBLE:
+		/* Fill the half not read, starting from the current value */
+		seq = atomic_get(&proxy->seq);
+		next = target_half(proxy, seq + 2);
+		memcpy(next, target_half(proxy, seq), proxy->target_len);
+		return next;
+	default:
+		return proxy->target;
+	}
+}
+
+void knot_data_write_end(u8_t id)
+{
+	struct knot_proxy *proxy;
+
+	if (id >= CONFIG_KNOT_THING_DATA_MAX || proxy_pool[id].id == 0xff)
+		return;
+
+	proxy = &proxy_pool[id];
+
+	compiler_barrier();
+
+	switch (proxy->sync) {
+	case KNOT_DATA_SYNC_SEQLOCK:
+		atomic_inc(&proxy->seq);
+		break;
+	case KNOT_DATA_SYNC_DOUBLE:
+		/* Publish the half just written */
+		atomic_add(&proxy->seq, 2);
+		break;
+	default:
+		break;
+	}
+}
+
 /* Proxy properties */
 u8_t knot_proxy_get_id(struct knot_proxy *proxy)
 {
@@ -309,7 +674,7 @@ const knot_schema *proxy_get_schema(u8_t id)
 	if (proxy_pool[id].id == 0xff)
 		return NULL;
 
-	return &(proxy_pool[id].schema);
+	return proxy_pool[id].schema;
 }
 
 u8_t proxy_get_last_id(void)
@@ -317,22 +682,89 @@ u8_t proxy_get_last_id(void)
 	return last_id;
 }
 
-static bool check_timeout(struct knot_proxy *proxy)
+/* FNV-1a hash */
+static u32_t digest_update(u32_t digest, const void *data, size_t len)
 {
-	u32_t current_time, elapsed_time;
+	const u8_t *byte = data;
 
-	if (!(KNOT_EVT_FLAG_TIME & proxy->config.event_flags))
-		return false;
+	while (len--) {
+		digest ^= *byte++;
+		digest *= 16777619U;
+	}
+
+	return digest;
+}
+
+u32_t proxy_get_schema_digest(void)
+{
+	const struct knot_proxy *proxy;
+	u32_t digest = 2166136261U;
+	int i;
 
-	current_time = k_uptime_get();
-	elapsed_time = current_time - proxy->last_timeout;
-	if (elapsed_time >= (proxy->config.time_sec * 1000)) {
-		proxy->last_timeout = current_time;
-		return true;
+	for (i = 0; i < CONFIG_KNOT_THING_DATA_MAX; i++) {
+		proxy = &proxy_pool[i];
+		if (proxy->id == 0xff)
+			continue;
+
+		digest = digest_update(digest, &proxy->id, sizeof(proxy->id));
+		digest = digest_update(digest, &proxy->schema->value_type,
+				       sizeof(proxy->schema->value_type));
+		digest = digest_update(digest, &proxy->schema->unit,
+				       sizeof(proxy->schema->unit));
+		digest = digest_update(digest, &proxy->schema->type_id,
+				       sizeof(proxy->schema->type_id));
+		digest = digest_update(digest, proxy->schema->name,
+				       strnlen(proxy->schema->name,
+					       sizeof(proxy->schema->name)));
 	}
+
+	return digest;
+}
+
+/* Any watched item not notified by the app: must be sampled */
+static bool has_sampled(void)
+{
+	int i;
+
+	for (i = 0; i < MAP_WORDS; i++) {
+		if (atomic_get(&watch_map[i]) & ~atomic_get(&push_map[i]))
+			return true;
+	}
+
 	return false;
 }
 
+s64_t proxy_get_next_deadline(void)
+{
+	s64_t deadline = -1;
+
+	if (heap_len > 0)
+		deadline = heap_deadline(0);
+
+	if (has_sampled() && (deadline < 0 || next_sample < deadline))
+		deadline = next_sample;
+
+	return deadline;
+}
+
+bool proxy_is_event_driven(u8_t id)
+{
+	if (id >= CONFIG_KNOT_THING_DATA_MAX)
+		return false;
+
+	return atomic_test_bit(watch_map, id);
+}
+
+static bool check_timeout(struct knot_proxy *proxy)
+{
+	bool timeout = proxy->timeout;
+
+	/* Flagged by the deadline scheduler */
+	proxy->timeout = false;
+
+	return timeout;
+}
+
 static bool set_proxy_value(struct knot_proxy *proxy,
 			    const knot_value_type value, size_t len)
 {
@@ -340,27 +772,35 @@ static bool set_proxy_value(struct knot_proxy *proxy,
 	bool upper;
 	bool lower;
 	bool timeout;
+	bool send;
 	bool ret;
 
 	bool bval;
 	s32_t s32val;
 	float fval;
 
+	knot_value_type old_value;
+	u8_t old_len;
+
 	ret = false; /* Default not sending */
 
 	if (unlikely(!proxy))
 		goto done;
 
+	old_value = proxy->value;
+	old_len = proxy->olen;
+
+	send = atomic_test_bit(pending_map, proxy->id);
 	timeout = check_timeout(proxy);
-	switch(proxy->schema.value_type) {
+	switch(proxy->schema->value_type) {
 	case KNOT_VALUE_TYPE_BOOL:
 		bval = value.val_b;
 		change = check_bool_change(proxy, bval);
 
-		if (proxy->send || timeout || change) {
+		if (send || timeout || change) {
 			proxy->olen = proxy->target_len;
 			proxy->value.val_b = bval;
-			proxy->send = proxy->wait_resp;
+			set_pending(proxy, proxy->wait_resp);
 			ret = true;
 		}
 		break;
@@ -370,12 +810,12 @@ static bool set_proxy_value(struct knot_proxy *proxy,
 		upper = check_int_upper_threshold(proxy, s32val);
 		lower = check_int_lower_threshold(proxy, s32val);
 
-		if ( proxy->send || timeout || change ||
+		if (send || timeout || change ||
 		    (upper && proxy->upper_flag == false) ||
 		    (lower && proxy->lower_flag == false)) {
 			proxy->olen = proxy->target_len;
 			proxy->value.val_i = s32val;
-			proxy->send = proxy->wait_resp;
+			set_pending(proxy, proxy->wait_resp);
 			ret = true;
 		}
 		proxy->upper_flag = upper; /* Send only at crossing */
@@ -387,12 +827,12 @@ static bool set_proxy_value(struct knot_proxy *proxy,
 		upper = check_float_upper_threshold(proxy, fval);
 		lower = check_float_lower_threshold(proxy, fval);
 
-		if ( proxy->send || timeout || change ||
+		if (send || timeout || change ||
 		    (upper && proxy->upper_flag == false) ||
 		    (lower && proxy->lower_flag == false)) {
 			proxy->olen = proxy->target_len;
 			proxy->value.val_f = fval;
-			proxy->send = proxy->wait_resp;
+			set_pending(proxy, proxy->wait_resp);
 			ret = true;
 		}
 		proxy->upper_flag = upper; /* Send only at crossing */
@@ -400,59 +840,133 @@ static bool set_proxy_value(struct knot_proxy *proxy,
 		break;
 	case KNOT_VALUE_TYPE_RAW:
 		change = check_raw_change(proxy, value.raw, len);
-		if (proxy->send || change || timeout) {
+		if (send || change || timeout) {
 			proxy->olen = len; /* Amount to send */
 			memcpy(proxy->value.raw, value.raw, len);
-			proxy->send = proxy->wait_resp;
+			set_pending(proxy, proxy->wait_resp);
 			ret = true;
 		}
 	}
+
+	/*
+	 * Acks of values sent before this one must not clear pending. Only
+	 * a new value counts: items flagged again keep acks of the same one.
+	 */
+	if (ret && (proxy->olen != old_len ||
+		    memcmp(&proxy->value, &old_value, old_len) != 0))
+		proxy->gen++;
 done:
 	return ret;
 }
 
-/* Return knot_value_type* so it can be flagged as const  */
-const knot_value_type *proxy_read(u8_t id, u8_t *olen, bool wait_resp)
+/* Copy last value given by knot_data_notify_value(), if any */
+static bool read_notified(struct knot_proxy *proxy, knot_value_type *val)
 {
-	struct knot_proxy *proxy;
-	knot_value_type read_val;
-	bool send_msg;
+	unsigned int key;
+	bool has_value;
 
-	if (proxy_pool[id].id == 0xff)
-		return NULL;
+	key = irq_lock();
+	has_value = proxy->notify_has_value;
+	if (has_value)
+		memcpy(val, &proxy->notify_value, sizeof(*val));
+	irq_unlock(key);
 
-	proxy = &proxy_pool[id];
+	return has_value;
+}
 
-	proxy->olen = 0;
+/* Written by the cloud: notified value is stale, read target instead */
+static void drop_notified(struct knot_proxy *proxy)
+{
+	unsigned int key;
 
-	/* Wait for response? */
-	proxy->wait_resp = wait_resp;
+	key = irq_lock();
+	proxy->notify_has_value = false;
+	irq_unlock(key);
+}
+
+/* Copy target with no write in between: retried a few times at most */
+static bool read_snapshot(struct knot_proxy *proxy, knot_value_type *val)
+{
+	atomic_val_t seq;
+	int tries;
+
+	for (tries = 0; tries < SNAPSHOT_TRIES; tries++) {
+		seq = atomic_get(&proxy->seq);
+
+		/* Write in progress */
+		if (seq & 1)
+			continue;
+
+		memcpy(val, target_half(proxy, seq), proxy->target_len);
+		compiler_barrier();
 
+		if (atomic_get(&proxy->seq) == seq)
+			return true;
+	}
+
+	return false;
+}
+
+static bool read_target(struct knot_proxy *proxy, knot_value_type *val)
+{
 	/* Execute read callback if set */
 	if (proxy->read_cb != NULL &&
-	    proxy->read_cb(id) < 0) {
-		LOG_INF("Read callback failed to ID %d", id);
-		return NULL;
+	    proxy->read_cb(proxy->id) < 0) {
+		LOG_INF("Read callback failed to ID %d", proxy->id);
+		return false;
+	}
+
+	/* Value at the start of the union whatever its type */
+	if (proxy->sync != KNOT_DATA_SYNC_NONE) {
+		if (read_snapshot(proxy, val))
+			return true;
+
+		/* Read again at the next poll */
+		LOG_DBG("Snapshot of ID %d busy", proxy->id);
+		return false;
 	}
 
 	/* Typecast value and read it */
-	switch(proxy->schema.value_type) {
+	switch(proxy->schema->value_type) {
 	case KNOT_VALUE_TYPE_BOOL:
-		read_val.val_b = *((bool*) proxy->target);
+		val->val_b = *((bool*) proxy->target);
 		break;
 	case KNOT_VALUE_TYPE_INT:
-		read_val.val_i = *((int*) proxy->target);
+		val->val_i = *((int*) proxy->target);
 		break;
 	case KNOT_VALUE_TYPE_FLOAT:
-		read_val.val_f = *((float*) proxy->target);
+		val->val_f = *((float*) proxy->target);
 		break;
 	case KNOT_VALUE_TYPE_RAW:
-		memcpy(read_val.raw, proxy->target, proxy->target_len);
+		memcpy(val->raw, proxy->target, proxy->target_len);
 		break;
 	default:
-		return NULL;
+		return false;
 	}
 
+	return true;
+}
+
+/* Return knot_value_type* so it can be flagged as const  */
+const knot_value_type *proxy_read(u8_t id, u8_t *olen, bool wait_resp)
+{
+	struct knot_proxy *proxy;
+	knot_value_type read_val;
+	bool send_msg;
+
+	if (proxy_pool[id].id == 0xff)
+		return NULL;
+
+	proxy = &proxy_pool[id];
+
+	/* Wait for response? */
+	proxy->wait_resp = wait_resp;
+
+	/* Last notified value replaces target and read callback */
+	if (!read_notified(proxy, &read_val) &&
+	    !read_target(proxy, &read_val))
+		return NULL;
+
 	/* Send message if proxy value is updated */
 	send_msg = set_proxy_value(proxy, read_val, proxy->target_len);
 	if (send_msg == false)
@@ -462,79 +976,73 @@ const knot_value_type *proxy_read(u8_t id, u8_t *olen, bool wait_resp)
 	return &proxy->value;
 }
 
-s8_t proxy_write(u8_t id, const knot_value_type *value, u8_t value_len)
+/* Length of the value being written by the cloud: 0 if none */
+static u8_t write_len;
+
+static int write_target(struct knot_proxy *proxy, void *target,
+			const knot_value_type *value, u8_t value_len)
 {
-	struct knot_proxy *proxy;
+	u8_t id = proxy->id;
 
 	/* Backup values */
 	knot_value_type old_value;
 
-	if (id > last_id)
-		return -EINVAL;
-
-	proxy = &proxy_pool[id];
-
-	if (proxy->id == 0xff)
-		return -EINVAL;
-
-	memcpy(&proxy->value, value, sizeof(*value));
-
 	/*
 	 * New values sent from cloud are informed to
 	 * the user app through write callback.
 	 */
-	switch(proxy->schema.value_type) {
+	switch(proxy->schema->value_type) {
 	case KNOT_VALUE_TYPE_BOOL:
 		/* Copy without backup if no write callback set */
 		if (proxy->write_cb == NULL) {
-			*((bool*) proxy->target) = value->val_b;
+			*((bool*) target) = value->val_b;
 			break;
 		}
 
 		/* Store old value before trying to update */
-		old_value.val_b = *((bool*) proxy->target);
-		*((bool*) proxy->target) = value->val_b;
+		old_value.val_b = *((bool*) target);
+		*((bool*) target) = value->val_b;
 
 		/* Get back to old value if write callback failed */
 		if (proxy->write_cb(id) < 0) {
 			LOG_INF("Write callback failed to ID %d", id);
-			*((bool*) proxy->target) = old_value.val_b;
+			*((bool*) target) = old_value.val_b;
 			return -EAGAIN;
 		}
 		break;
 	case KNOT_VALUE_TYPE_INT:
 		/* Copy without backup if no write callback set */
 		if (proxy->write_cb == NULL) {
-			*((int*) proxy->target) = value->val_i;
+			*((int*) target) = value->val_i;
 			break;
 		}
 
 		/* Store old value before trying to update */
-		old_value.val_i = *((int*) proxy->target);
-		*((int*) proxy->target) = value->val_i;
+		old_value.val_i = *((int*) target);
+		*((int*) target) = value->val_i;
 
 		/* Get back to old value if write callback failed */
 		if (proxy->write_cb(id) < 0) {
 			LOG_INF("Write callback failed to ID %d", id);
-			*((int*) proxy->target) = old_value.val_i;
+			*((int*) target) = old_value.val_i;
 			return -EAGAIN;
 		}
 		break;
 	case KNOT_VALUE_TYPE_FLOAT:
 		/* Copy without backup if no write callback set */
 		if (proxy->write_cb == NULL) {
-			*((float*) proxy->target) = value->val_f;
+			*((float*) target) = value->val_f;
 			break;
 		}
 
 		/* Store old value before trying to update */
-		old_value.val_f = *((float*) proxy->target);
-		*((float*) proxy->target) = value->val_f;
+		old_value.val_f = *((float*) target);
+		*((float*) target) = value->val_f;
 
 		/* Get back to old value if write callback failed */
 		if (proxy->write_cb(id) < 0) {
 			LOG_INF("Write callback failed to ID %d", id);
-			*((float*) proxy->target) = old_value.val_f;
+			*((float*) target) = old_value.val_f;
 			return -EAGAIN;
 		}
 		break;
@@ -549,22 +1057,22 @@ s8_t proxy_write(u8_t id, const knot_value_type *value, u8_t value_len)
 
 		/* Copy without backup if no write callback set */
 		if (proxy->write_cb == NULL) {
-			memset(proxy->target, 0, proxy->target_len);
-			memcpy(proxy->target, value->raw, value_len);
+			memset(target, 0, proxy->target_len);
+			memcpy(target, value->raw, value_len);
 			break;
 		}
 
 		/* Store old values */
-		memcpy(old_value.raw, proxy->target, proxy->target_len);
+		memcpy(old_value.raw, target, proxy->target_len);
 
 		/* Update value */
-		memset(proxy->target, 0, proxy->target_len);
-		memcpy(proxy->target, value->raw, value_len);
+		memset(target, 0, proxy->target_len);
+		memcpy(target, value->raw, value_len);
 
 		/* Get back to old value if write callback failed */
 		if (proxy->write_cb(id) < 0) {
 			LOG_INF("Write callback failed to ID %d", id);
-			memcpy(proxy->target, old_value.raw,
+			memcpy(target, old_value.raw,
 			       proxy->target_len);
 			return -EAGAIN;
 		}
@@ -573,6 +1081,73 @@ s8_t proxy_write(u8_t id, const knot_value_type *value, u8_t value_len)
 		return -EINVAL;
 	}
 
+	return 0;
+}
+
+const void *knot_data_get_write_value(u8_t id, size_t *len)
+{
+	if (id >= CONFIG_KNOT_THING_DATA_MAX || proxy_pool[id].id == 0xff)
+		return NULL;
+
+	/* Only valid while the write callback runs */
+	if (write_len == 0)
+		return NULL;
+
+	*len = write_len;
+	return &proxy_pool[id].value;
+}
+
+s8_t proxy_write(u8_t id, const knot_value_type *value, u8_t value_len)
+{
+	struct knot_proxy *proxy;
+	int ret;
+
+	if (id > last_id)
+		return -EINVAL;
+
+	proxy = &proxy_pool[id];
+
+	if (proxy->id == 0xff)
+		return -EINVAL;
+
+	memcpy(&proxy->value, value, sizeof(*value));
+
+	if (proxy->sync == KNOT_DATA_SYNC_NONE) {
+		ret = write_target(proxy, proxy->target, value, value_len);
+		if (ret < 0)
+			return ret;
+
+		drop_notified(proxy);
+		return proxy->olen;
+	}
+
+	/*
+	 * Synchronized items have a single writer: the app applies the
+	 * value from its write callback, between its own begin/end calls.
+	 */
+	if (proxy->write_cb == NULL) {
+		LOG_WRN("Write failed for ID %d: no write callback", id);
+		return -EPERM;
+	}
+
+	if (proxy->schema->value_type == KNOT_VALUE_TYPE_RAW &&
+	    value_len > proxy->target_len) {
+		LOG_WRN("Write failed for ID %d: "
+			"Msg too big for buffer (%d > %d)",
+			id, value_len, proxy->target_len);
+		return -EFBIG;
+	}
+
+	write_len = value_len;
+	ret = proxy->write_cb(id);
+	write_len = 0;
+
+	if (ret < 0) {
+		LOG_INF("Write callback failed to ID %d", id);
+		return -EAGAIN;
+	}
+
+	drop_notified(proxy);
 	return proxy->olen;
 }
 
@@ -586,12 +1161,17 @@ s8_t proxy_force_send(u8_t id)
 	proxy = &proxy_pool[id];
 
 	/* Flag 'value' to be sent, but don't wait response */
-	proxy->send = true;
+	set_pending(proxy, true);
 
 	return 0;
 }
 
-s8_t proxy_confirm_sent(u8_t id)
+u8_t proxy_get_gen(u8_t id)
+{
+	return proxy_pool[id].gen;
+}
+
+s8_t proxy_confirm_sent(u8_t id, u8_t gen)
 {
 	struct knot_proxy *proxy;
 
@@ -600,8 +1180,80 @@ s8_t proxy_confirm_sent(u8_t id)
 	if (proxy->id == 0xff)
 		return -EINVAL;
 
+	/* Sampled again while in flight: new value must be sent */
+	if (proxy->gen != gen)
+		return -EAGAIN;
+
 	/* No need to resend */
-	proxy->send = false;
+	set_pending(proxy, false);
 
 	return 0;
 }
+
+void proxy_poll(void)
+{
+	atomic_val_t word;
+	s64_t now;
+	u8_t olen;
+	u8_t id;
+	int bit;
+	int i;
+
+	/* Read periodic items whose deadline is reached */
+	now = k_uptime_get();
+	while (heap_len > 0 && heap_deadline(0) <= now) {
+		id = deadline_heap[0];
+		heap_schedule_next(now);
+
+		/* Sampled items are read below */
+		if (!atomic_test_bit(watch_map, id) ||
+		    atomic_test_bit(push_map, id))
+			proxy_read(id, &olen, true);
+	}
+
+	/* Read items notified by the app since last poll */
+	for (i = 0; i < MAP_WORDS; i++) {
+		word = atomic_clear(&notify_map[i]);
+		while (word) {
+			bit = find_lsb_set(word) - 1;
+			word &= ~BIT(bit);
+			proxy_read((i * ATOMIC_BITS) + bit, &olen, true);
+		}
+	}
+
+	if (now < next_sample)
+		return;
+
+	next_sample = now + CONFIG_KNOT_SAMPLE_PERIOD;
+
+	/*
+	 * Sample only watched items not notified by the app, once every
+	 * period: pending ones are flagged on read.
+	 */
+	for (i = 0; i < MAP_WORDS; i++) {
+		word = atomic_get(&watch_map[i]) & ~atomic_get(&push_map[i]);
+		while (word) {
+			bit = find_lsb_set(word) - 1;
+			word &= ~BIT(bit);
+			proxy_read((i * ATOMIC_BITS) + bit, &olen, true);
+		}
+	}
+}
+
+int proxy_get_pending(u8_t from)
+{
+	return find_next_set(pending_map, from);
+}
+
+const knot_value_type *proxy_get_value(u8_t id, u8_t *olen)
+{
+	struct knot_proxy *proxy;
+
+	proxy = &proxy_pool[id];
+
+	if (proxy->id == 0xff)
+		return NULL;
+
+	*olen = proxy->olen;
+	return &proxy->value;
+}
@@ -14,10 +14,32 @@ void proxy_stop(void);
 
 u8_t proxy_get_last_id(void);
 
+/* Digest of the schemas of all registered items */
+u32_t proxy_get_schema_digest(void);
+
 const knot_value_type *proxy_read(u8_t id, uint8_t *olen, bool wait_resp);
 
 s8_t proxy_write(u8_t id, const knot_value_type *value, u8_t value_len);
 
 s8_t proxy_force_send(u8_t id);
 
-s8_t proxy_confirm_sent(u8_t id);
+/* Generation of the value to send: changes whenever the value does */
+u8_t proxy_get_gen(u8_t id);
+
+/* Clear pending flag if value is still the one sent at generation 'gen' */
+s8_t proxy_confirm_sent(u8_t id, u8_t gen);
+
+/* Sample watched items and flag the ones that must be sent */
+void proxy_poll(void);
+
+/* Next item flagged to be sent, searching from 'from' and wrapping around */
+int proxy_get_pending(u8_t from);
+
+/* Uptime (ms) of the next periodic send or -1 if there is none */
+s64_t proxy_get_next_deadline(void);
+
+/* Item sent on value change or threshold instead of only periodically */
+bool proxy_is_event_driven(u8_t id);
+
+/* Last value flagged to be sent */
+const knot_value_type *proxy_get_value(u8_t id, u8_t *olen);
@@ -0,0 +1,126 @@
+/* rto.c - KNoT Application Client */
+
+/*
+ * Copyright (c) 2019, CESAR. All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * Retransmission timeout estimator: smoothed round trip time and its
+ * variation set the timeout of each request, as TCP does (RFC 6298).
+ * Consecutive timeouts double the timeout and add jitter so things
+ * don't retry in lockstep.
+ */
+
+#include <zephyr.h>
+#include <logging/log.h>
+#include <string.h>
+
+#include "rto.h"
+
+LOG_MODULE_DECLARE(knot, CONFIG_KNOT_LOG_LEVEL);
+
+#ifndef MAX
+#define MAX(a, b)         (((a) > (b)) ? (a) : (b))
+#endif
+
+#define RTO_GRANULARITY		10 /* ms */
+#define RTO_BACKOFF_MAX		6
+
+static struct rto_stats stats;
+
+static s32_t clamp_rto(s64_t rto)
+{
+	if (rto < CONFIG_KNOT_RTO_MIN)
+		return CONFIG_KNOT_RTO_MIN;
+
+	if (rto > CONFIG_KNOT_RTO_MAX)
+		return CONFIG_KNOT_RTO_MAX;
+
+	return rto;
+}
+
+void rto_init(void)
+{
+	memset(&stats, 0, sizeof(stats));
+	stats.rto = CONFIG_KNOT_RTO_INIT;
+}
+
+/* Backoff runs from timer context: state is changed with irqs locked */
+void rto_sample(s32_t rtt)
+{
+	unsigned int key;
+	s32_t delta;
+
+	if (rtt < 0)
+		return;
+
+	key = irq_lock();
+
+	if (stats.samples == 0) {
+		/* First measurement */
+		stats.srtt = rtt;
+		stats.rttvar = rtt / 2;
+	} else {
+		delta = stats.srtt - rtt;
+		if (delta < 0)
+			delta = -delta;
+
+		/* alpha = 1/8 and beta = 1/4 */
+		stats.rttvar = ((3 * stats.rttvar) + delta) / 4;
+		stats.srtt = ((7 * stats.srtt) + rtt) / 8;
+	}
+
+	stats.rto = clamp_rto(stats.srtt +
+			      MAX(RTO_GRANULARITY, 4 * stats.rttvar));
+	stats.samples++;
+
+	/* Valid response: stop backing off */
+	stats.backoff = 0;
+
+	irq_unlock(key);
+}
+
+/* Called from timer context: keep it short */
+void rto_backoff(void)
+{
+	unsigned int key = irq_lock();
+
+	if (stats.backoff < RTO_BACKOFF_MAX)
+		stats.backoff++;
+
+	stats.timeouts++;
+
+	irq_unlock(key);
+}
+
+s32_t rto_get(void)
+{
+	unsigned int key;
+	s64_t rto;
+	u8_t backoff;
+
+	key = irq_lock();
+	rto = stats.rto;
+	backoff = stats.backoff;
+	irq_unlock(key);
+
+	if (backoff == 0)
+		return rto;
+
+	/* Exponential backoff plus up to 25% of jitter */
+	rto <<= backoff;
+	rto += sys_rand32_get() % ((rto / 4) + 1);
+
+	return clamp_rto(rto);
+}
+
+void rto_get_stats(struct rto_stats *out)
+{
+	unsigned int key = irq_lock();
+
+	memcpy(out, &stats, sizeof(stats));
+
+	irq_unlock(key);
+}
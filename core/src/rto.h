@@ -0,0 +1,27 @@
+/* rto.h - KNoT Application Client */
+
+/*
+ * Copyright (c) 2019, CESAR. All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/* Retransmission timeout estimator (RFC 6298) */
+
+struct rto_stats {
+	s32_t srtt;		/* Smoothed round trip time (ms) */
+	s32_t rttvar;		/* Round trip time variation (ms) */
+	s32_t rto;		/* Retransmission timeout without backoff (ms) */
+	u8_t backoff;		/* Consecutive timeouts */
+	u32_t timeouts;		/* Total timeouts */
+	u32_t samples;		/* Total round trip time samples */
+};
+
+void rto_init(void);
+
+void rto_sample(s32_t rtt);
+void rto_backoff(void);
+
+s32_t rto_get(void);
+
+void rto_get_stats(struct rto_stats *stats);
@@ -0,0 +1,338 @@
+/* rudp.c - KNoT Application Client */
+
+/*
+ * Copyright (c) 2019, CESAR. All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * Lightweight reliability layer for the UDP transport. Each datagram
+ * starts with a header holding its sequence number and the selective
+ * ack of the datagrams received: the latest sequence number and a
+ * bitmap of the ones before it. Data datagrams are kept until acked and
+ * sent again on timeout, or as soon as acks for later datagrams show a
+ * gap. Received duplicates are acked again but not delivered. A random
+ * epoch picked at each start tells a peer restart from old datagrams.
+ */
+
+#include <zephyr.h>
+#include <logging/log.h>
+#include <string.h>
+#include <net/buf.h>
+
+#include "net.h"
+#include "rudp.h"
+
+LOG_MODULE_DECLARE(knot, CONFIG_KNOT_LOG_LEVEL);
+
+#define RUDP_FLAG_DATA		BIT(0)
+#define RUDP_FLAG_ACK		BIT(1)
+
+#define RUDP_ACK_BITS		8	/* Datagrams acked before 'ack' */
+#define RUDP_FAST_RETX		2	/* Acks showing a gap to send again */
+#define RUDP_PDU_LEN		CONFIG_KNOT_PDU_SIZE
+
+struct rudp_hdr {
+	u8_t flags;
+	u8_t epoch;		/* Sender session: new at each start */
+	u8_t seq;		/* Sequence number of data datagram */
+	u8_t ack;		/* Latest sequence number received */
+	u8_t ack_bits;		/* Bit n: received 'ack' - 1 - n */
+} __packed;
+
+BUILD_ASSERT(sizeof(struct rudp_hdr) == RUDP_HDR_LEN);
+
+struct rudp_slot {
+	u8_t buf[RUDP_HDR_LEN + RUDP_PDU_LEN];
+	size_t len;
+	s64_t deadline;		/* Uptime to send again */
+	u8_t retries;
+	u8_t nacks;		/* Acks received showing a gap */
+	bool used;
+};
+
+static struct rudp_slot slots[CONFIG_KNOT_UDP_TX_SLOTS];
+static struct rudp_stats stats;
+static rudp_output_t output_cb;
+static net_recv_t recv_cb;
+static K_MUTEX_DEFINE(lock);
+
+static u8_t tx_epoch;		/* Session of datagrams sent */
+static u8_t tx_seq;		/* Next sequence number to send */
+static u8_t rx_epoch;		/* Session of 'rx_seq' */
+static u8_t rx_seq;		/* Latest sequence number received */
+static u8_t rx_bits;		/* Received before 'rx_seq' */
+static bool rx_any;		/* Any data datagram received */
+
+/* Sequence number 'a' comes after 'b' */
+static bool seq_after(u8_t a, u8_t b)
+{
+	return ((s8_t) (a - b)) > 0;
+}
+
+static void set_ack(struct rudp_hdr *hdr)
+{
+	if (!rx_any)
+		return;
+
+	hdr->flags |= RUDP_FLAG_ACK;
+	hdr->ack = rx_seq;
+	hdr->ack_bits = rx_bits;
+}
+
+static void send_ack(void)
+{
+	struct rudp_hdr hdr;
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.epoch = tx_epoch;
+	set_ack(&hdr);
+
+	output_cb((const u8_t *) &hdr, sizeof(hdr));
+}
+
+static void slot_send(struct rudp_slot *slot)
+{
+	/* Piggyback the latest ack */
+	set_ack((struct rudp_hdr *) slot->buf);
+
+	output_cb(slot->buf, slot->len);
+	slot->deadline = k_uptime_get() +
+			 (CONFIG_KNOT_UDP_RTO << slot->retries);
+	slot->nacks = 0;
+}
+
+static void process_ack(u8_t ack, u8_t ack_bits)
+{
+	struct rudp_slot *slot;
+	u8_t seq;
+	u8_t d;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(slots); i++) {
+		slot = &slots[i];
+		if (!slot->used)
+			continue;
+
+		seq = ((struct rudp_hdr *) slot->buf)->seq;
+		d = ack - seq;
+
+		/* Acked directly or by the selective ack bitmap */
+		if (d == 0 || (d <= RUDP_ACK_BITS && (ack_bits & BIT(d - 1)))) {
+			slot->used = false;
+			continue;
+		}
+
+		/* Later datagram acked: this one is probably lost */
+		if (seq_after(ack, seq) && ++slot->nacks == RUDP_FAST_RETX &&
+		    slot->retries < CONFIG_KNOT_UDP_RETRIES) {
+			stats.fast_retransmits++;
+			slot->retries++;
+			slot_send(slot);
+		}
+	}
+}
+
+/* Return true if 'seq' was received already */
+static bool rx_seen(u8_t seq)
+{
+	u8_t d = rx_seq - seq;
+
+	if (!rx_any || seq_after(seq, rx_seq))
+		return false;
+
+	if (d == 0)
+		return true;
+
+	/* Older than the bitmap: can't tell, consider it received */
+	if (d > RUDP_ACK_BITS)
+		return true;
+
+	return (rx_bits & BIT(d - 1));
+}
+
+static void rx_mark(u8_t seq)
+{
+	u8_t d;
+
+	if (!rx_any) {
+		rx_any = true;
+		rx_seq = seq;
+		rx_bits = 0;
+		return;
+	}
+
+	/* Newer: previous latest becomes bit 'd - 1' */
+	if (seq_after(seq, rx_seq)) {
+		d = seq - rx_seq;
+		rx_bits = (d > RUDP_ACK_BITS) ? 0 :
+			  ((rx_bits << d) | BIT(d - 1));
+		rx_seq = seq;
+		return;
+	}
+
+	d = rx_seq - seq;
+	rx_bits |= BIT(d - 1);
+}
+
+void rudp_init(rudp_output_t output, net_recv_t recv)
+{
+	k_mutex_lock(&lock, K_FOREVER);
+
+	memset(slots, 0, sizeof(slots));
+	output_cb = output;
+	recv_cb = recv;
+	tx_epoch = sys_rand32_get();
+	tx_seq = 0;
+	rx_any = false;
+
+	k_mutex_unlock(&lock);
+}
+
+int rudp_send(const u8_t *buf, size_t len)
+{
+	struct rudp_slot *slot = NULL;
+	struct rudp_hdr *hdr;
+	int i;
+
+	if (len > RUDP_PDU_LEN)
+		return -EMSGSIZE;
+
+	k_mutex_lock(&lock, K_FOREVER);
+
+	for (i = 0; i < ARRAY_SIZE(slots); i++) {
+		if (!slots[i].used) {
+			slot = &slots[i];
+			break;
+		}
+	}
+
+	/* All slots waiting ack: net thread holds the PDU until one is free */
+	if (!slot) {
+		k_mutex_unlock(&lock);
+		LOG_WRN("RUDP: No slot available");
+		return -ENOBUFS;
+	}
+
+	hdr = (struct rudp_hdr *) slot->buf;
+	memset(hdr, 0, sizeof(*hdr));
+	hdr->flags = RUDP_FLAG_DATA;
+	hdr->epoch = tx_epoch;
+	hdr->seq = tx_seq++;
+	memcpy(slot->buf + sizeof(*hdr), buf, len);
+
+	slot->len = sizeof(*hdr) + len;
+	slot->retries = 0;
+	slot->used = true;
+	slot_send(slot);
+
+	k_mutex_unlock(&lock);
+
+	/* Net thread may be waiting past the deadline of this datagram */
+	net_wakeup();
+
+	return len;
+}
+
+int rudp_input(struct net_buf *pdu)
+{
+	struct rudp_hdr hdr;
+	bool dup;
+
+	if (pdu->len < sizeof(hdr)) {
+		LOG_WRN("RUDP: Invalid datagram");
+		net_buf_unref(pdu);
+		return -EINVAL;
+	}
+
+	/* Strip header: message is delivered from the same buffer */
+	memcpy(&hdr, pdu->data, sizeof(hdr));
+	net_buf_pull(pdu, sizeof(hdr));
+
+	k_mutex_lock(&lock, K_FOREVER);
+
+	if (hdr.flags & RUDP_FLAG_ACK)
+		process_ack(hdr.ack, hdr.ack_bits);
+
+	/* Ack only */
+	if (!(hdr.flags & RUDP_FLAG_DATA)) {
+		k_mutex_unlock(&lock);
+		net_buf_unref(pdu);
+		return 0;
+	}
+
+	/* Peer restarted: its sequence numbers start over */
+	if (rx_any && hdr.epoch != rx_epoch) {
+		LOG_INF("RUDP: Peer restarted");
+		rx_any = false;
+	}
+	rx_epoch = hdr.epoch;
+
+	dup = rx_seen(hdr.seq);
+	if (!dup)
+		rx_mark(hdr.seq);
+
+	/* Ack duplicates too: previous ack may be lost */
+	send_ack();
+
+	if (dup)
+		stats.duplicates++;
+
+	k_mutex_unlock(&lock);
+
+	if (dup) {
+		net_buf_unref(pdu);
+		return 0;
+	}
+
+	return recv_cb(pdu);
+}
+
+s32_t rudp_process(void)
+{
+	struct rudp_slot *slot;
+	s64_t next = -1;
+	s64_t now;
+	int i;
+
+	k_mutex_lock(&lock, K_FOREVER);
+
+	now = k_uptime_get();
+	for (i = 0; i < ARRAY_SIZE(slots); i++) {
+		slot = &slots[i];
+		if (!slot->used)
+			continue;
+
+		if (slot->deadline <= now) {
+			if (slot->retries >= CONFIG_KNOT_UDP_RETRIES) {
+				LOG_WRN("RUDP: Giving up seq %d",
+					((struct rudp_hdr *) slot->buf)->seq);
+				stats.drops++;
+				slot->used = false;
+				continue;
+			}
+
+			stats.retransmits++;
+			slot->retries++;
+			slot_send(slot);
+		}
+
+		if (next < 0 || slot->deadline < next)
+			next = slot->deadline;
+	}
+
+	k_mutex_unlock(&lock);
+
+	if (next < 0)
+		return K_FOREVER;
+
+	return (next > now) ? (s32_t) (next - now) : K_NO_WAIT;
+}
+
+void rudp_get_stats(struct rudp_stats *out)
+{
+	k_mutex_lock(&lock, K_FOREVER);
+	memcpy(out, &stats, sizeof(stats));
+	k_mutex_unlock(&lock);
+}
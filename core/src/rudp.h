@@ -0,0 +1,31 @@
+/* rudp.h - KNoT Application Client */
+
+/*
+ * Copyright (c) 2019, CESAR. All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/* Reliable UDP: sequence numbers, selective acks and retransmissions */
+
+#define RUDP_HDR_LEN	5
+
+typedef int (*rudp_output_t) (const u8_t *buf, size_t len);
+
+struct rudp_stats {
+	u32_t retransmits;	/* Datagrams sent again */
+	u32_t fast_retransmits;	/* Sent again before timeout: gap acked */
+	u32_t drops;		/* Datagrams given up after max retries */
+	u32_t duplicates;	/* Received datagrams already delivered */
+};
+
+void rudp_init(rudp_output_t output, net_recv_t recv);
+
+int rudp_send(const u8_t *buf, size_t len);
+/* Ownership of the received datagram is taken */
+int rudp_input(struct net_buf *pdu);
+
+/* Retransmit datagrams not acked in time. Return time to next check */
+s32_t rudp_process(void);
+
+void rudp_get_stats(struct rudp_stats *stats);
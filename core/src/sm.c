@@ -10,6 +10,7 @@
 
 #include <zephyr.h>
 #include <net/net_core.h>
+#include <net/buf.h>
 #include <logging/log.h>
 
 #include <knot/knot_protocol.h>
@@ -18,15 +19,24 @@
 #include "sm.h"
 #include "storage.h"
 #include "peripheral.h"
+#include "rto.h"
+#include "proto.h"
+#include "net.h"
 
 LOG_MODULE_DECLARE(knot, CONFIG_KNOT_LOG_LEVEL);
 
-#define TIMEOUT_WIN				3 /* 3 sec */
+#if CONFIG_KNOT_DATA_BATCH
+#define BATCH_MAX		CONFIG_KNOT_DATA_BATCH_MAX
+#else
+#define BATCH_MAX		1
+#endif
 
 static struct k_timer to;	/* Re-send timeout */
 static u8_t xpt_opcode;		/* Expected response OPCODE */
 static bool to_on;		/* Timeout active */
 static bool to_xpr;		/* Timeout expired */
+static bool to_retx;		/* Waiting response of a retransmission */
+static s64_t to_sent;		/* Uptime when request was sent */
 
 /*
  * Internally uuid and token must be null terminated. When copying or
@@ -37,6 +47,16 @@ static char token[KNOT_PROTOCOL_TOKEN_LEN + 1];	/* Device token */
 static u64_t device_id;				/* Device id */
 static bool rst_flag; 				/* Reset flag */
 
+#if CONFIG_KNOT_KEEPALIVE
+#define KA_IDLE		K_SECONDS(CONFIG_KNOT_KEEPALIVE_IDLE)
+#define KA_TIMEOUT	K_SECONDS(CONFIG_KNOT_KEEPALIVE_TIMEOUT)
+
+static s64_t last_rx;		/* Uptime of last message received */
+static bool ka_sent;		/* Keepalive waiting response */
+#endif
+static bool peer_lost;		/* Nothing received from peer for too long */
+static bool running;		/* Started: deadlines below are valid */
+
 enum sm_state {
 	STATE_REG,		/* Registers new device */
 	STATE_AUTH,		/* Authenticate known device */
@@ -47,10 +67,38 @@ enum sm_state {
 
 static enum sm_state state;
 
+/* Data message waiting response */
+struct sm_inflight {
+	u8_t ids[BATCH_MAX];	/* Sensor ids */
+	u8_t gens[BATCH_MAX];	/* Value generation of each id when sent */
+	u8_t count;		/* Amount of sensor ids */
+	u8_t seq;		/* Sequence number */
+	s64_t sent;		/* Uptime when message was sent */
+	s64_t deadline;		/* Uptime to give up waiting response */
+};
+
+static struct sm_inflight window[CONFIG_KNOT_DATA_WINDOW];
+static u8_t win_len;		/* Messages waiting response */
+static u8_t win_seq;		/* Next sequence number */
+static u8_t win_max;		/* Window size allowed by the peer */
+
+/*
+ * Batch responses carry the sequence number. A stock data response only
+ * carries the result, so it identifies the message only if it is the one
+ * in flight: a window is opened once the peer echoes sensor ids.
+ */
+#if CONFIG_KNOT_DATA_BATCH
+#define WIN_MAX_INIT	CONFIG_KNOT_DATA_WINDOW
+#else
+#define WIN_MAX_INIT	1
+#endif
+
 static void timer_expired(struct k_timer *to)
 {
 	to_xpr = true;
 	to_on = false;
+	rto_backoff();
+	proto_wakeup();
 	LOG_WRN("Timeout expired!");
 }
 
@@ -92,6 +140,7 @@ static bool wl_opcode(const enum sm_state state, const u8_t *ipdu, size_t ilen)
 	 */
 	case KNOT_MSG_PUSH_DATA_REQ:
 	case KNOT_MSG_POLL_DATA_REQ:
+	case KNOT_MSG_KEEPALIVE_REQ:
 		return true;
 	default:
 		return false;
@@ -133,6 +182,19 @@ done:
 	return next;
 }
 
+/* Check the schemas against the digest stored when they were last sent */
+static bool schema_changed(void)
+{
+	u32_t digest;
+	int rc;
+
+	rc = storage_read(STORAGE_SCHEMA_DIGEST, &digest, sizeof(digest));
+	if (rc != sizeof(digest))
+		return true;
+
+	return (digest != proxy_get_schema_digest());
+}
+
 static enum sm_state state_auth(u8_t *xpt_opcode,
 				const u8_t *ipdu, size_t ilen,
 				u8_t *opdu, size_t olen, size_t *len)
@@ -162,22 +224,64 @@ static enum sm_state state_auth(u8_t *xpt_opcode,
 
 	/* Credentials are only saved on NVM after all the schemas are sent */
 	LOG_INF("Successfully authenticated!");
+
+	/* Schemas changed since they were last sent: send them again */
+	if (schema_changed()) {
+		LOG_INF("Schemas changed");
+		next = STATE_SCH;
+		goto done;
+	}
+
 	next =  STATE_ONLINE;
 
 done:
 	return next;
 }
 
+/* Next item with a valid schema from 'id' or -ENOENT if none left */
+static int next_schema(int id)
+{
+	u8_t last_id = proxy_get_last_id();
+
+	/* No item registered */
+	if (last_id == 0xff)
+		return -ENOENT;
+
+	for (; id <= last_id; id++)
+		if (proxy_get_schema(id) != NULL)
+			return id;
+
+	return -ENOENT;
+}
+
+/* Schema fragments waiting response, sent in id order */
+static int sch_next;			/* Next schema to send */
+static int sch_ack;			/* Oldest schema waiting response */
+static u8_t sch_pending;		/* Fragments waiting response */
+static bool sch_failed;			/* Fragment rejected: resend */
+
+/* True if more schema fragments may be sent before any response */
+static bool schema_window_open(void)
+{
+	if (sch_failed || sch_next < 0)
+		return false;
+
+	/* End fragment is only sent after all fragments are confirmed */
+	if (next_schema(sch_next + 1) < 0)
+		return (sch_pending == 0);
+
+	return (sch_pending < CONFIG_KNOT_SCHEMA_WINDOW);
+}
+
 static enum sm_state state_schema(u8_t *xpt_opcode,
 				  const u8_t *ipdu, size_t ilen,
 				  u8_t *opdu, size_t olen, size_t *len)
 {
 	const knot_msg *imsg = (knot_msg *) ipdu;
-	knot_msg *omsg = (knot_msg *) opdu;
+	knot_msg *omsg;
 	enum sm_state next = STATE_SCH;
 	const knot_schema *schema;
-	static u8_t id_index = 0;
-	u8_t last_id;
+	u32_t digest;
 	int res;
 	bool end;
 
@@ -185,20 +289,42 @@ static enum sm_state state_schema(u8_t *xpt_opcode,
 
 	/* First attempt or timeout expired, resend schemas */
 	if (*xpt_opcode == 0xff || to_xpr) {
-		id_index = 0;
+		sch_next = next_schema(0);
+		sch_ack = sch_next;
+		sch_pending = 0;
+		sch_failed = false;
 		goto send;
 	}
 
+	/* Not a response: keep sending while the window is open */
+	if (ilen == 0 || imsg->hdr.type != *xpt_opcode)
+		goto send;
+
 	/* OPCODE verified before entering state. Checking result */
 	switch (*xpt_opcode) {
 	case KNOT_MSG_SCHM_FRAG_RSP:
-		/* Resend last fragment if failed */
-		if (imsg->action.result == 0)
-			id_index++;
+		if (sch_pending == 0)
+			goto send;
+
+		sch_pending--;
+
+		/* Resend from rejected fragment once others are answered */
+		if (imsg->action.result != 0)
+			sch_failed = true;
+		else if (!sch_failed)
+			sch_ack = next_schema(sch_ack + 1);
+
+		if (sch_failed && sch_pending == 0) {
+			sch_next = sch_ack;
+			sch_failed = false;
+		}
 		goto send;
 	case KNOT_MSG_SCHM_END_RSP:
-		if (imsg->action.result != 0)
+		/* Resend end fragment if failed */
+		if (imsg->action.result != 0) {
+			sch_next = sch_ack;
 			goto send;
+		}
 
 		LOG_DBG("Setting credentials!");
 		/* Save UUID */
@@ -225,6 +351,12 @@ static enum sm_state state_schema(u8_t *xpt_opcode,
 			next = STATE_ERROR;
 			goto done;
 		}
+		/* Schemas known by the cloud: skip sending them on auth */
+		digest = proxy_get_schema_digest();
+		res = storage_write(STORAGE_SCHEMA_DIGEST,
+				    &digest, sizeof(digest));
+		if (res != sizeof(digest))
+			LOG_WRN("Failed to set schema digest");
 
 		LOG_INF("Successfully registered!");
 		LOG_INF("UUID: %s", uuid);
@@ -236,90 +368,297 @@ static enum sm_state state_schema(u8_t *xpt_opcode,
 	}
 
 send:
-	/* Send schema */
-	last_id = proxy_get_last_id();
-	while (id_index <= last_id) {
-		schema = proxy_get_schema(id_index);
-		if (schema == NULL) {
-			/* Ignore invalid aio  */
-			id_index++;
-			continue;
-		}
-		end = ((id_index == last_id) ? true : false);
-		*xpt_opcode = (end ? KNOT_MSG_SCHM_END_RSP :
-				     KNOT_MSG_SCHM_FRAG_RSP);
+	/* Send schemas, packing fragments while there is room */
+	while (schema_window_open()) {
+		schema = proxy_get_schema(sch_next);
+		end = (next_schema(sch_next + 1) < 0);
+
+		if (*len + sizeof(omsg->hdr) + sizeof(omsg->schema.sensor_id) +
+		    sizeof(omsg->schema.values) > olen)
+			break;
+
 		LOG_DBG("Creating schema message");
-		*len = msg_create_schema(omsg, id_index, schema, end);
-		break;
+		omsg = (knot_msg *) (opdu + *len);
+		*len += msg_create_schema(omsg, sch_next, schema, end);
+
+		if (end) {
+			*xpt_opcode = KNOT_MSG_SCHM_END_RSP;
+			sch_ack = sch_next;
+			sch_next = -ENOENT;
+			break;
+		}
+
+		*xpt_opcode = KNOT_MSG_SCHM_FRAG_RSP;
+		sch_pending++;
+		sch_next = next_schema(sch_next + 1);
+
+		/* Back to back messages are only parsed from a stream */
+		if (!IS_ENABLED(CONFIG_KNOT_SCHEMA_PACK) || !net_is_stream())
+			break;
 	}
 done:
 	return next;
 }
 
-static size_t process_event(u8_t *xpt_opcode,
-			    const u8_t *ipdu, size_t ilen,
+/* Data messages waiting response, in sending order */
+static void window_reset(void)
+{
+	win_len = 0;
+	win_max = WIN_MAX_INIT;
+}
+
+static int window_find(u8_t id)
+{
+	u8_t i;
+	u8_t j;
+
+	for (i = 0; i < win_len; i++)
+		for (j = 0; j < window[i].count; j++)
+			if (window[i].ids[j] == id)
+				return i;
+
+	return -ENOENT;
+}
+
+static struct sm_inflight *window_push(void)
+{
+	struct sm_inflight *entry = &window[win_len];
+
+	entry->count = 0;
+	entry->seq = win_seq++;
+	entry->sent = k_uptime_get();
+	entry->deadline = entry->sent + rto_get();
+	win_len++;
+
+	return entry;
+}
+
+static void window_remove(u8_t i)
+{
+	/* Keep sending order: shift newer entries over the removed one */
+	for (; i + 1 < win_len; i++)
+		window[i] = window[i + 1];
+
+	win_len--;
+}
+
+static int window_find_seq(u8_t seq)
+{
+	u8_t i;
+
+	for (i = 0; i < win_len; i++)
+		if (window[i].seq == seq)
+			return i;
+
+	return -ENOENT;
+}
+
+/*
+ * Match a data response to an outstanding message. Batch responses
+ * carry the sequence number and data responses may carry the sensor id
+ * after the result. A stock response is only accepted with a single
+ * message in flight: any other match would be a guess.
+ */
+static int window_match(const knot_msg *imsg)
+{
+	const u8_t *extra = (const u8_t *) &imsg->action.result + 1;
+
+	if (win_len == 0)
+		return -ENOENT;
+
+	if (imsg->hdr.payload_len <= sizeof(imsg->action.result))
+		return (win_len == 1) ? 0 : -ENOENT;
+
+	if (imsg->hdr.type == KNOT_MSG_PUSH_DATA_BATCH_RSP)
+		return window_find_seq(*extra);
+
+	/* Peer identifies responses: more messages may be in flight */
+	win_max = CONFIG_KNOT_DATA_WINDOW;
+
+	return window_find(*extra);
+}
+
+/* Drop messages not answered in time: items remain pending to resend */
+static void window_expire(void)
+{
+	struct sm_inflight *entry;
+	s64_t now = k_uptime_get();
+	u8_t i = 0;
+
+	while (i < win_len) {
+		entry = &window[i];
+		if (entry->deadline > now) {
+			i++;
+			continue;
+		}
+
+		rto_backoff();
+		LOG_WRN("Timeout for seq %d (%d items). RTO %d ms",
+			entry->seq, entry->count, rto_get());
+		window_remove(i);
+	}
+}
+
+/* Next pending item from 'from' that is not waiting response */
+static int next_pending(u8_t from)
+{
+	int id;
+	int i;
+
+	/* Items waiting response are skipped, at most one per window slot */
+	id = proxy_get_pending(from);
+	for (i = 0; i < win_len * BATCH_MAX && id >= 0 &&
+	     window_find(id) >= 0; i++)
+		id = proxy_get_pending(id + 1);
+
+	if (id < 0 || window_find(id) >= 0)
+		return -ENOENT;
+
+	return id;
+}
+
+#if !CONFIG_KNOT_DATA_BATCH
+/* Create a data message for a single item */
+static size_t create_data(int id, knot_msg *omsg)
+{
+	struct sm_inflight *entry;
+	const knot_value_type *value;
+	u8_t value_len = 0;
+	size_t len;
+
+	value = proxy_get_value(id, &value_len);
+	if (unlikely(!value))
+		return 0;
+
+	/* Send data and wait for response */
+	len = msg_create_data(omsg, id, value, value_len, false);
+	entry = window_push();
+	entry->ids[entry->count] = id;
+	entry->gens[entry->count++] = proxy_get_gen(id);
+
+	return len;
+}
+#else
+static s64_t coalesce_end = -1;		/* End of coalescing window */
+
+/* Pack pending items, starting at 'id', in a single data message */
+static size_t create_batch(int id, knot_msg *omsg, size_t olen)
+{
+	struct sm_inflight *entry;
+	const knot_value_type *value;
+	u8_t value_len = 0;
+	s64_t now = k_uptime_get();
+	size_t len;
+	size_t ret;
+	int first = id;
+
+	/* Wait for items that become pending close together */
+	if (coalesce_end < 0)
+		coalesce_end = now + CONFIG_KNOT_DATA_BATCH_DELAY;
+
+	if (now < coalesce_end)
+		return 0;
+
+	coalesce_end = -1;
+
+	entry = window_push();
+	len = msg_create_data_batch(omsg, entry->seq);
+
+	do {
+		value = proxy_get_value(id, &value_len);
+		if (likely(value)) {
+			ret = msg_add_data_batch(omsg, olen, id,
+						 value, value_len);
+			/* No room left on PDU */
+			if (ret == 0)
+				break;
+
+			len = ret;
+			entry->ids[entry->count] = id;
+			entry->gens[entry->count++] = proxy_get_gen(id);
+		}
+
+		id = next_pending(id + 1);
+	} while (id >= 0 && id != first && entry->count < BATCH_MAX);
+
+	/* Nothing could be packed */
+	if (entry->count == 0) {
+		win_len--;
+		return 0;
+	}
+
+	return len;
+}
+#endif
+
+static size_t process_event(const u8_t *ipdu, size_t ilen,
 			    u8_t *opdu, size_t olen,
 			    bool *perm_error)
 {
 	knot_msg *omsg = (knot_msg *) opdu;
 	const knot_msg *imsg = (knot_msg *) ipdu;
-	const knot_value_type *value;
+	struct sm_inflight *entry;
 	int8_t err;
-	u8_t value_len = 0;
 	static u8_t id_index = 0;
-	u8_t old_id;
-	u8_t last_id;
-	s8_t len = 0;
-
-	last_id = proxy_get_last_id();
-
-	/* No response expected. Continue polling */
-	if (*xpt_opcode == 0xff)
-		goto polling;
+	int id;
+	int i;
+
+	/* Response to one of the messages in the window */
+	if (ilen != 0 && (imsg->hdr.type == KNOT_MSG_PUSH_DATA_RSP ||
+			  imsg->hdr.type == KNOT_MSG_PUSH_DATA_BATCH_RSP)) {
+		i = window_match(imsg);
+		if (i < 0) {
+			LOG_WRN("Unexpected data response");
+			goto polling;
+		}
 
-	/*
-	 * OPCODE and timeout verified before entering state.
-	 * If timeout expired or received an error message simply ignore it
-	 * and send data of the next sensor.
-	 */
-	if (to_xpr || imsg->action.result != 0) {
+		entry = &window[i];
+		rto_sample(k_uptime_get() - entry->sent);
 		err = imsg->action.result;
-		LOG_ERR("FAIL SEND FOR ID %d (err: %d)", id_index, err);
-
-		if (err != KNOT_ERR_PERM)
+		if (err == 0) {
+			/* Values changed since sent remain pending */
+			while (entry->count > 0) {
+				entry->count--;
+				proxy_confirm_sent(entry->ids[entry->count],
+						   entry->gens[entry->count]);
+			}
+			window_remove(i);
 			goto polling;
+		}
 
-		/* Permission error found */
-		*perm_error = true;
-		return 0;
-	} else
-		proxy_confirm_sent(id_index);
+		/* Items remain pending and they will be sent again */
+		LOG_ERR("FAIL SEND FOR SEQ %d (err: %d)", entry->seq, err);
+		window_remove(i);
+
+		if (err == KNOT_ERR_PERM) {
+			/* Permission error found */
+			*perm_error = true;
+			return 0;
+		}
+	}
 
 polling:
-	/*
-	 * The polling is finished when a message to be sent is found or when
-	 * finish reading all sensors
-	 */
-	old_id = id_index; /* Old sensor id */
-	do {
-		id_index = (id_index < last_id ? id_index + 1 : 0);
+	window_expire();
 
-		value = proxy_read(id_index, &value_len, true);
-		/* Check next sensor if no data is to be sent */
-		if (!value) {
-			continue;
-		}
+	/* Window full: wait responses */
+	if (win_len >= win_max)
+		return 0;
 
-		/* Send data and wait for response */
-		len = msg_create_data(omsg, id_index, value, value_len, false);
-		*xpt_opcode = KNOT_MSG_PUSH_DATA_RSP;
-		break;
-	} while (id_index != old_id);
+	/* Sample local sensors: changed items are flagged as pending */
+	proxy_poll();
 
-	if (len <= 0)
-		*xpt_opcode = 0xff;
+	/* Next pending item after the last one sent: round-robin */
+	id = next_pending(id_index + 1);
+	if (id < 0)
+		return 0;
 
-	return len;
+	id_index = id;
+
+#if CONFIG_KNOT_DATA_BATCH
+	return create_batch(id, omsg, olen);
+#else
+	return create_data(id, omsg);
+#endif
 }
 
 static size_t process_cmd(const u8_t *ipdu, size_t ilen,
@@ -390,6 +729,9 @@ static size_t process_cmd(const u8_t *ipdu, size_t ilen,
 	case KNOT_MSG_PUSH_CONFIG_REQ:
 		/* TODO */
 		break;
+	case KNOT_MSG_KEEPALIVE_REQ:
+		len = msg_create_keepalive(omsg, true);
+		break;
 	default:
 		break;
 	}
@@ -413,8 +755,7 @@ static enum sm_state state_online(u8_t *xpt_opcode,
 	/* Local sensor/actuator */
 	if (ret_len == 0) {
 		/* Local event */
-		ret_len = process_event(xpt_opcode, ipdu, ilen,
-					opdu, olen, &perm_error);
+		ret_len = process_event(ipdu, ilen, opdu, olen, &perm_error);
 
 		/* Need to authenticate to fix permission error */
 		if (perm_error) {
@@ -423,6 +764,15 @@ static enum sm_state state_online(u8_t *xpt_opcode,
 		}
 	}
 
+#if CONFIG_KNOT_KEEPALIVE
+	/* Idle for too long: check the peer is still there */
+	if (ret_len == 0 && !ka_sent && k_uptime_get() >= last_rx + KA_IDLE) {
+		LOG_DBG("Sending keepalive");
+		ret_len = msg_create_keepalive((knot_msg *) opdu, false);
+		ka_sent = true;
+	}
+#endif
+
 	if (ret_len > 0)
 		*len = ret_len;
 
@@ -441,6 +791,7 @@ int sm_start(void)
 
 	LOG_DBG("SM: Start");
 
+	running = true;
 	state = STATE_AUTH; /* Initial state */
 
 	device_id = 0;
@@ -486,6 +837,16 @@ done:
 	to_on = false;
 	to_xpr = false;
 	xpt_opcode = 0xff;
+	window_reset();
+
+	/* Round trip time is measured per connection */
+	rto_init();
+
+	peer_lost = false;
+#if CONFIG_KNOT_KEEPALIVE
+	last_rx = k_uptime_get();
+	ka_sent = false;
+#endif
 
 	return 0;
 }
@@ -493,12 +854,19 @@ done:
 void sm_stop(void)
 {
 	LOG_DBG("SM: Stop");
+	running = false;
 	if (to_on)
 		k_timer_stop(&to);
 
 	proxy_stop();
 }
 
+/* Disconnected: items are still sampled and sent once ONLINE */
+void sm_poll_offline(void)
+{
+	proxy_poll();
+}
+
 void sm_init(void)
 {
 	LOG_DBG("SM: Init");
@@ -517,6 +885,21 @@ int sm_run(const u8_t *ipdu, size_t ilen, u8_t *opdu, size_t olen)
 
 	bool got_resp; /* Got right response */
 
+#if CONFIG_KNOT_KEEPALIVE
+	/* Any message shows the peer is alive */
+	if (ilen != 0) {
+		last_rx = k_uptime_get();
+		ka_sent = false;
+	} else if (!peer_lost &&
+		   k_uptime_get() >= last_rx + KA_IDLE + KA_TIMEOUT) {
+		LOG_WRN("Peer not responding");
+		peer_lost = true;
+	}
+
+	if (peer_lost)
+		return 0;
+#endif
+
 	/*
 	 * When the timer is enabled, if no data is received or the expected
 	 * response was not matched, it is not necessary to run the state
@@ -532,8 +915,13 @@ int sm_run(const u8_t *ipdu, size_t ilen, u8_t *opdu, size_t olen)
 			to_xpr = false;
 			LOG_DBG("Got expected resp");
 
+			/* Retransmissions are ambiguous: don't sample them */
+			if (!to_retx)
+				rto_sample(k_uptime_get() - to_sent);
+
 
-		} else if (wl_opcode(state, ipdu, ilen) == false)
+		} else if (wl_opcode(state, ipdu, ilen) == false &&
+			   !(state == STATE_SCH && schema_window_open()))
 			/* OPCODE doesn't belong to white list. Wait */
 			return 0;
 	}
@@ -565,6 +953,7 @@ int sm_run(const u8_t *ipdu, size_t ilen, u8_t *opdu, size_t olen)
 	/* State has changed: Don't wait response */
 	if (next != state) {
 		xpt_opcode = 0xff;
+		window_reset();
 
 		status_blink_period = STATUS_DISCONN_PERIOD;
 
@@ -605,7 +994,9 @@ int sm_run(const u8_t *ipdu, size_t ilen, u8_t *opdu, size_t olen)
 
 	/* Waiting response: Run timer */
 	if (to_on == false) {
-		k_timer_start(&to, K_SECONDS(TIMEOUT_WIN), 0);
+		k_timer_start(&to, rto_get(), 0);
+		to_sent = k_uptime_get();
+		to_retx = to_xpr;
 		to_on = true;
 		to_xpr = false;
 		LOG_DBG("Timer on");
@@ -621,3 +1012,53 @@ bool sm_get_reset(void)
 {
 	return rst_flag;
 }
+
+bool sm_get_peer_lost(void)
+{
+	return peer_lost;
+}
+
+/* Earliest of two uptimes where -1 means none */
+static s64_t earliest(s64_t a, s64_t b)
+{
+	if (a < 0 || (b >= 0 && b < a))
+		return b;
+
+	return a;
+}
+
+s64_t sm_get_next_deadline(void)
+{
+	s64_t deadline = -1;
+	u8_t i;
+
+	/* Stopped: only items are sampled, connection deadlines are stale */
+	if (!running)
+		return proxy_get_next_deadline();
+
+#if CONFIG_KNOT_KEEPALIVE
+	/* Peer lost if nothing is received. Keepalive is sent when ONLINE */
+	if (!peer_lost)
+		deadline = last_rx + KA_IDLE +
+			   ((ka_sent || state != STATE_ONLINE) ? KA_TIMEOUT : 0);
+#endif
+
+	/* Requests of other states are handled by the SM timer */
+	if (state != STATE_ONLINE)
+		return deadline;
+
+	/* Next periodic or sampled item: not polled while window is full */
+	if (win_len < win_max)
+		deadline = earliest(deadline, proxy_get_next_deadline());
+
+	/* Data messages waiting response */
+	for (i = 0; i < win_len; i++)
+		deadline = earliest(deadline, window[i].deadline);
+
+#if CONFIG_KNOT_DATA_BATCH
+	/* Items waiting to be packed */
+	deadline = earliest(deadline, coalesce_end);
+#endif
+
+	return deadline;
+}
@@ -11,7 +11,17 @@
 void sm_init(void);
 int sm_start(void);
 void sm_stop(void);
+void sm_poll_offline(void);
 
 int sm_run(const u8_t *ipdu, size_t ilen, u8_t *opdu, size_t olen);
 
 bool sm_get_reset(void);
+
+/* Nothing received for the keepalive period: connection must restart */
+bool sm_get_peer_lost(void);
+
+/*
+ * Uptime (ms) the SM must run again or -1 if it only waits for events.
+ * While stopped, only data items to sample are reported.
+ */
+s64_t sm_get_next_deadline(void);
@@ -32,22 +32,36 @@ LOG_MODULE_REGISTER(knot_storage, CONFIG_KNOT_LOG_LEVEL);
 #define TOKEN_KEY		"token"
 #define DEVID_KEY		"devid"
 #define IPV6_KEY		"ipv6"
+#define SCHEMA_KEY		"schema"
+#define TRANSPORT_KEY		"transport"
+#define PEERS_KEY		"peers"
+#define GATEWAY_KEY		"gateway"
 
 #define SAVE_UUID_KEY		NAMESPACE "/" UUID_KEY
 #define SAVE_TOKEN_KEY		NAMESPACE "/" TOKEN_KEY
 #define SAVE_DEVID_KEY		NAMESPACE "/" DEVID_KEY
 #define SAVE_IPV6_KEY		NAMESPACE "/" IPV6_KEY
+#define SAVE_SCHEMA_KEY		NAMESPACE "/" SCHEMA_KEY
+#define SAVE_TRANSPORT_KEY	NAMESPACE "/" TRANSPORT_KEY
+#define SAVE_PEERS_KEY		NAMESPACE "/" PEERS_KEY
+#define SAVE_GATEWAY_KEY	NAMESPACE "/" GATEWAY_KEY
 
 /* Buffer sizes */
 #define UUID_LEN	36
 #define TOKEN_LEN	40
 #define IPV6_LEN	40
+#define TRANSPORT_LEN	8
+#define PEER_LIST_LEN	128
 
 /* Buffers */
 static char uuid[UUID_LEN];		/* Device UUID */
 static char token[TOKEN_LEN];		/* Device Token */
 static char peer_ipv6[TOKEN_LEN];	/* Peer's IPV6 */
 static uint64_t devid;			/* Device ID */
+static uint32_t schema_digest;		/* Digest of registered schemas */
+static char transport[TRANSPORT_LEN];	/* Network transport name */
+static char peer_list[PEER_LIST_LEN];	/* Peers' IPV6 and priorities */
+static char peer_cache[IPV6_LEN];	/* Discovered gateway's IPV6 */
 
 struct key_fmt {
 	const char *save_key;	/* Settings name or key */
@@ -62,6 +76,10 @@ static struct key_fmt buf_info[] = {
 	{ SAVE_TOKEN_KEY,	token,		sizeof(token),		false },
 	{ SAVE_DEVID_KEY,	&devid,		sizeof(devid),		false },
 	{ SAVE_IPV6_KEY,	peer_ipv6,	sizeof(peer_ipv6),	false },
+	{ SAVE_SCHEMA_KEY,	&schema_digest,	sizeof(schema_digest),	false },
+	{ SAVE_TRANSPORT_KEY,	transport,	sizeof(transport),	false },
+	{ SAVE_PEERS_KEY,	peer_list,	sizeof(peer_list),	false },
+	{ SAVE_GATEWAY_KEY,	peer_cache,	sizeof(peer_cache),	false },
 };
 
 static int set(int argc, char **argv, void *value_ctx)
@@ -81,6 +99,14 @@ static int set(int argc, char **argv, void *value_ctx)
 		fmt = &buf_info[STORAGE_CRED_DEVID];
 	else if (!strcmp(argv[0], IPV6_KEY))
 		fmt = &buf_info[STORAGE_PEER_IPV6];
+	else if (!strcmp(argv[0], SCHEMA_KEY))
+		fmt = &buf_info[STORAGE_SCHEMA_DIGEST];
+	else if (!strcmp(argv[0], TRANSPORT_KEY))
+		fmt = &buf_info[STORAGE_TRANSPORT];
+	else if (!strcmp(argv[0], PEERS_KEY))
+		fmt = &buf_info[STORAGE_PEER_LIST];
+	else if (!strcmp(argv[0], GATEWAY_KEY))
+		fmt = &buf_info[STORAGE_PEER_CACHE];
 	else /* Ignore invalid key */
 		return -ENOENT;
 
@@ -171,6 +197,22 @@ int storage_reset(void)
 	if (rc)
 		return rc;
 
+	rc = clear_value(STORAGE_SCHEMA_DIGEST);
+	if (rc)
+		return rc;
+
+	rc = clear_value(STORAGE_TRANSPORT);
+	if (rc)
+		return rc;
+
+	rc = clear_value(STORAGE_PEER_LIST);
+	if (rc)
+		return rc;
+
+	rc = clear_value(STORAGE_PEER_CACHE);
+	if (rc)
+		return rc;
+
 	return clear_value(STORAGE_PEER_IPV6);
 }
 
@@ -12,6 +12,10 @@ enum storage_keys {
 	STORAGE_CRED_TOKEN,
 	STORAGE_CRED_DEVID,
 	STORAGE_PEER_IPV6,
+	STORAGE_SCHEMA_DIGEST,
+	STORAGE_TRANSPORT,
+	STORAGE_PEER_LIST,
+	STORAGE_PEER_CACHE,
 };
 
 int storage_init(void);
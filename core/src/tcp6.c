@@ -16,70 +16,120 @@
 #include <net/net_context.h>
 #include <net/socket.h>
 
+#include <knot/knot_protocol.h>
+
 #include "net.h"
+#include "pdu.h"
 #include "tcp6.h"
-#include "storage.h"
 
 LOG_MODULE_DECLARE(knot, CONFIG_KNOT_LOG_LEVEL);
 
 #define PEER_IPV6_PORT 8886
-#define IPV6_LEN	40
 
-static char peer_ipv6[IPV6_LEN];
 static struct zsock_pollfd fds;
 static net_recv_t recv_cb;
 static net_close_t close_cb;
 static int socket;
 
+/*
+ * TCP is a byte stream: messages may be split or merged across reads.
+ * Only the bytes missing to the current message are read, straight into
+ * the buffer handed to PROTO once the message is complete.
+ */
+static struct net_buf *rx_pdu;
+
+/* Bytes left to read: header first, then its payload */
+static size_t rx_missing(void)
+{
+	const knot_msg_header *hdr = (const knot_msg_header *) rx_pdu->data;
+
+	if (rx_pdu->len < sizeof(*hdr))
+		return sizeof(*hdr) - rx_pdu->len;
+
+	return sizeof(*hdr) + hdr->payload_len - rx_pdu->len;
+}
+
+/* Deliver message at the reassembly buffer if complete */
+static int deliver(void)
+{
+	const knot_msg_header *hdr = (const knot_msg_header *) rx_pdu->data;
+	int rc;
+
+	if (rx_pdu->len < sizeof(*hdr))
+		return 0;
+
+	/* Message can never fit: stream is out of sync */
+	if (sizeof(*hdr) + hdr->payload_len > CONFIG_KNOT_PDU_SIZE) {
+		LOG_ERR("Msg too big (%d bytes)",
+			sizeof(*hdr) + hdr->payload_len);
+		return -EMSGSIZE;
+	}
+
+	/* Wait for the rest of the message */
+	if (rx_missing() != 0)
+		return 0;
+
+	rc = recv_cb(rx_pdu);
+	if (rc)
+		LOG_ERR("Msg dropped (%d)", rc);
+
+	rx_pdu = NULL;
+
+	return 0;
+}
+
 static int receive(void)
 {
 	int rc;
 	int err;
-	size_t len = 0;
-	char buf[128];
-
-	/* Read socket until no data left */
-	while (true) {
-		rc = zsock_recv(socket, buf + len, sizeof(buf) - len,
-				ZSOCK_MSG_DONTWAIT);
-
-		/* Update len and check for more data */
-		if (rc > 0) {
-			len += rc;
-			continue;
-		}
-		/* Save errno to avoid changes by interruption */
-		err = errno;
 
-		if (rc == 0) {
-			if (len != 0) {
-				/* Read finished */
-				LOG_WRN("Nothing left to read");
-				break;
-			}
-			LOG_ERR("No message found (errno %d)", errno);
+	/*
+	 * One read per poll event: no buffer is taken just to find the
+	 * socket empty. Net thread polls again at once if more is left.
+	 */
+	if (!rx_pdu) {
+		rx_pdu = pdu_alloc(PDU_RX, K_NO_WAIT);
+		if (!rx_pdu)
+			return -ENOBUFS;
+	}
+
+	rc = zsock_recv(socket, net_buf_tail(rx_pdu), rx_missing(),
+			ZSOCK_MSG_DONTWAIT);
 
-			/* Disconnected */
-			if (err == EALREADY)
-				tcp6_stop();
+	/* Deliver message if complete */
+	if (rc > 0) {
+		net_buf_add(rx_pdu, rc);
 
-			return -EIO;
+		rc = deliver();
+		if (rc) {
+			/* Restart connection to sync stream again */
+			tcp6_stop();
+			return rc;
 		}
 
-		/* rc < 0 */
-		/* Finish if EAGAIN and EWOULDBLOCK */
-		if (err == EAGAIN || err == EWOULDBLOCK)
-			break;
+		return 0;
+	}
+	/* Save errno to avoid changes by interruption */
+	err = errno;
+
+	/* Readable but no data: peer closed the connection */
+	if (rc == 0) {
+		LOG_WRN("Connection closed by peer");
+		tcp6_stop();
+		return -ECONNRESET;
+	}
 
-		LOG_ERR("Socket read err: %d", rc);
+	/* rc < 0 */
+	/* Nothing left if EAGAIN and EWOULDBLOCK */
+	if (err == EAGAIN || err == EWOULDBLOCK)
+		return 0;
 
-		if (err == EBADF)
-			tcp6_stop();
+	LOG_ERR("Socket read err: %d", rc);
 
-		return -err;
-	}
+	if (err == EBADF)
+		tcp6_stop();
 
-	return recv_cb(buf, len);
+	return -err;
 }
 
 static void set_fds(void)
@@ -100,6 +150,11 @@ static int start_tcp_proto(const struct sockaddr *addr, socklen_t addrlen)
 		return -err;
 	}
 
+	/*
+	 * Blocks the net thread only, for up to the socket connect timeout:
+	 * Zephyr 1.14 sockets ignore O_NONBLOCK on connect and report
+	 * POLLOUT before the handshake ends. The KNoT thread keeps sampling.
+	 */
 	rc = zsock_connect(socket, addr, addrlen);
 	if (rc < 0) {
 		err = errno;
@@ -115,10 +170,17 @@ static void socket_close(void)
 	if (socket >= 0) {
 		LOG_DBG("Closing socket %d", socket);
 		(void)zsock_close(socket);
+		socket = -1;
+	}
+
+	/* Drop partial message: stream starts again on next connection */
+	if (rx_pdu) {
+		net_buf_unref(rx_pdu);
+		rx_pdu = NULL;
 	}
 }
 
-int tcp6_start(net_recv_t recv, net_close_t close)
+int tcp6_start(const char *addr, net_recv_t recv, net_close_t close)
 {
 	int rc;
 	struct sockaddr_in6 addr6;
@@ -126,7 +188,7 @@ int tcp6_start(net_recv_t recv, net_close_t close)
 	memset(&addr6, 0, sizeof(addr6));
 	addr6.sin6_family = AF_INET6;
 	addr6.sin6_port = htons(PEER_IPV6_PORT);
-	rc = zsock_inet_pton(AF_INET6, peer_ipv6, &addr6.sin6_addr);
+	rc = zsock_inet_pton(AF_INET6, addr, &addr6.sin6_addr);
 	if (rc <= 0)
 		return -EFAULT;
 
@@ -179,31 +241,23 @@ int tcp6_send(const u8_t *buf, size_t len)
 
 int tcp6_init(void)
 {
-	int rc;
-
 	/* Reset callbacks */
 	recv_cb = NULL;
 	close_cb = NULL;
 
 	LOG_DBG("Initializing TCP handler");
 
-	rc = storage_read(STORAGE_PEER_IPV6, peer_ipv6, sizeof(peer_ipv6));
-	if (rc <= 0) {
-		LOG_ERR("Failed to read Peer's IPv6");
-		return -ENOENT;
-	}
-
 	return 0;
 }
 
-int tcp6_event_poll(void)
+int tcp6_event_poll(int timeout)
 {
 	int ret, rc;
 
 	/*
 	 * Check if any event occurred on fds poll fds.
 	 */
-	ret = zsock_poll(&fds, 1, 0);
+	ret = net_poll(&fds, timeout);
 	if (ret < 0)
 		LOG_ERR("Error in poll: %d", ret);
 
@@ -214,13 +268,23 @@ int tcp6_event_poll(void)
 			LOG_ERR("Read failure: %d", rc);
 	}
 
-	// TODO: Handle POLLHUP
-	if(fds.revents & ZSOCK_POLLHUP)
-		LOG_DBG("Event HUP");
-
-	// TODO: Handle POLLERR
-	if(fds.revents & ZSOCK_POLLERR)
-		LOG_DBG("Event ERR");
+	/* Peer closed or connection failed: data read already */
+	if (socket >= 0 &&
+	    (fds.revents & (ZSOCK_POLLHUP | ZSOCK_POLLERR | ZSOCK_POLLNVAL))) {
+		LOG_WRN("Socket %s", (fds.revents & ZSOCK_POLLHUP) ?
+			"hang up" : "error");
+		tcp6_stop();
+	}
 
 	return ret;
 }
+
+const struct net_transport tcp6_transport = {
+	.name = "tcp",
+	.stream = true,
+	.init = tcp6_init,
+	.start = tcp6_start,
+	.stop = tcp6_stop,
+	.send = tcp6_send,
+	.event_poll = tcp6_event_poll,
+};
@@ -17,62 +17,68 @@
 #include <net/socket.h>
 
 #include "net.h"
+#include "pdu.h"
 #include "udp6.h"
-#include "storage.h"
+#include "rudp.h"
 
 LOG_MODULE_DECLARE(knot, CONFIG_KNOT_LOG_LEVEL);
 
 #define PEER_IPV6_PORT 8886
-#define IPV6_LEN	40
 
-static char peer_ipv6[IPV6_LEN];
 static struct zsock_pollfd fds;
 static net_recv_t recv_cb;
 static net_close_t close_cb;
 static int socket;
 
+/* Deliver one datagram: each one holds a whole message */
+static int deliver(struct net_buf *pdu)
+{
+	#if CONFIG_KNOT_UDP_RELIABLE
+		return rudp_input(pdu);
+	#else
+		return recv_cb(pdu);
+	#endif
+}
+
 static int receive(void)
 {
+	struct net_buf *pdu;
 	int rc;
 	int err;
-	size_t len = 0;
-	char buf[128];
-
-	/* Read socket until no data left */
-	while (true) {
-		rc = zsock_recv(socket, buf + len, sizeof(buf) - len,
-				ZSOCK_MSG_DONTWAIT);
-
-		/* Update len and check for more data */
-		if (rc > 0) {
-			len += rc;
-			continue;
-		}
-		/* Save errno to avoid changes by interruption */
-		err = errno;
 
-		if (rc == 0) {
-			if (len != 0) {
-				/* Read finished */
-				LOG_WRN("Nothing left to read");
-				break;
-			}
-
-			LOG_ERR("No message found (err %d)", err);
-			return -EIO;
-		}
+	/*
+	 * One datagram per poll event: no buffer is taken just to find the
+	 * socket empty. Net thread polls again at once if more are left.
+	 */
+	pdu = pdu_alloc(PDU_RX, K_NO_WAIT);
+	if (!pdu)
+		return -ENOBUFS;
+
+	/* Datagram is read straight into the buffer handed to PROTO */
+	rc = zsock_recv(socket, pdu->data, net_buf_tailroom(pdu),
+			ZSOCK_MSG_DONTWAIT);
+
+	if (rc > 0) {
+		net_buf_add(pdu, rc);
+		rc = deliver(pdu);
+		if (rc)
+			LOG_ERR("Msg dropped (%d)", rc);
+		return 0;
+	}
+	/* Save errno to avoid changes by interruption */
+	err = errno;
+	net_buf_unref(pdu);
 
-		/* rc < 0 */
-		/* Finish if EAGAIN and EWOULDBLOCK */
-		if (err == EAGAIN || err == EWOULDBLOCK)
-			break;
+	/* Empty datagram or nothing left */
+	if (rc == 0 || err == EAGAIN || err == EWOULDBLOCK)
+		return 0;
 
-		LOG_ERR("Socket read err: %d", rc);
+	LOG_ERR("Socket read err: %d", rc);
 
-		return -err;
-	}
+	if (err == EBADF)
+		udp6_stop();
 
-	return recv_cb(buf, len);
+	return -err;
 }
 
 static void set_fds(void)
@@ -81,7 +87,7 @@ static void set_fds(void)
 	fds.events = ZSOCK_POLLIN;
 }
 
-int udp6_send(const u8_t *buf, size_t len)
+static int socket_send(const u8_t *buf, size_t len)
 {
 	ssize_t pend_len = len;
 	ssize_t out_len;
@@ -100,6 +106,15 @@ int udp6_send(const u8_t *buf, size_t len)
 	return len;
 }
 
+int udp6_send(const u8_t *buf, size_t len)
+{
+	#if CONFIG_KNOT_UDP_RELIABLE
+		return rudp_send(buf, len);
+	#else
+		return socket_send(buf, len);
+	#endif
+}
+
 static int start_udp_proto(const struct sockaddr *addr, socklen_t addrlen)
 {
 	int rc;
@@ -124,7 +139,7 @@ static int start_udp_proto(const struct sockaddr *addr, socklen_t addrlen)
 	return rc;
 }
 
-int udp6_start(net_recv_t recv, net_close_t close)
+int udp6_start(const char *addr, net_recv_t recv, net_close_t close)
 {
 	int rc;
 	struct sockaddr_in6 addr6;
@@ -132,7 +147,7 @@ int udp6_start(net_recv_t recv, net_close_t close)
 	memset(&addr6, 0, sizeof(addr6));
 	addr6.sin6_family = AF_INET6;
 	addr6.sin6_port = htons(8886);
-	rc = zsock_inet_pton(AF_INET6, peer_ipv6,
+	rc = zsock_inet_pton(AF_INET6, addr,
 			&addr6.sin6_addr);
 	if (rc <= 0)
 		return -EFAULT;
@@ -151,6 +166,10 @@ int udp6_start(net_recv_t recv, net_close_t close)
 	recv_cb = recv;
 	close_cb = close;
 
+	#if CONFIG_KNOT_UDP_RELIABLE
+		rudp_init(socket_send, recv);
+	#endif
+
 	return rc;
 }
 
@@ -171,42 +190,58 @@ void udp6_stop(void)
 
 int udp6_init(void)
 {
-	int rc;
-
 	/* Reset callbacks */
 	recv_cb = NULL;
 	close_cb = NULL;
 
 	LOG_DBG("Initializing UDP handler");
 
-	rc = storage_read(STORAGE_PEER_IPV6, peer_ipv6, sizeof(peer_ipv6));
-	if (rc <= 0) {
-		LOG_ERR("Failed to read Peer's IPv6");
-		return -ENOENT;
-	}
-
 	return 0;
 }
 
-int udp6_event_poll(void)
+int udp6_event_poll(int timeout)
 {
 	int ret, rc;
 
+	#if CONFIG_KNOT_UDP_RELIABLE
+		/* Wake up in time to retransmit */
+		rc = rudp_process();
+		if (rc != K_FOREVER && (timeout == K_FOREVER || rc < timeout))
+			timeout = rc;
+	#endif
+
 	/*
 	 * Check if any event occurred on fds poll.
 	 */
-	ret = zsock_poll(&fds, 1, 0);
+	ret = net_poll(&fds, timeout);
 	if (ret < 0)
 		LOG_ERR("Error in poll: %d", ret);
 
 	if (fds.revents & ZSOCK_POLLIN) {
 		LOG_DBG("Msg received");
 		rc = receive();
-		if (rc) {
+		if (rc)
 			LOG_ERR("Read failure: %d", rc);
-			k_sleep(K_FOREVER);
-		}
 	}
 
+	/* Datagram sockets fail on ICMP errors, e.g. peer unreachable */
+	if (socket >= 0 && (fds.revents & (ZSOCK_POLLERR | ZSOCK_POLLNVAL))) {
+		LOG_WRN("Socket error");
+		udp6_stop();
+	}
+
+	#if CONFIG_KNOT_UDP_RELIABLE
+		rudp_process();
+	#endif
+
 	return ret;
-}
\ No newline at end of file
+}
+
+const struct net_transport udp6_transport = {
+	.name = "udp",
+	.init = udp6_init,
+	.start = udp6_start,
+	.stop = udp6_stop,
+	.send = udp6_send,
+	.event_poll = udp6_event_poll,
+};
@@ -6,10 +6,12 @@
  * SPDX-License-Identifier: Apache-2.0
  */
 
-int udp6_start(net_recv_t recv, net_close_t close);
+int udp6_start(const char *addr, net_recv_t recv, net_close_t close);
 void udp6_stop(void);
 
 int udp6_send(const u8_t *buf, size_t len);
 
-int udp6_event_poll(void);
+int udp6_event_poll(int timeout);
 int udp6_init(void);
+
+extern const struct net_transport udp6_transport;
@@ -8,6 +8,7 @@
 
 #include <zephyr.h>
 #include <logging/log.h>
+#include <string.h>
 
 #include <bluetooth/bluetooth.h>
 #include <bluetooth/gatt.h>
@@ -17,10 +18,46 @@
 
 /* Buffer len */
 #define PEER_IPV6_LEN 40
+#define TRANSPORT_LEN 8
+#define PEER_LIST_LEN 128
 
 LOG_MODULE_DECLARE(knot_setup, LOG_LEVEL_DBG);
 
+/* Characteristic value, stored as a '\0' padded string */
+struct config_value {
+	enum storage_keys key;
+	char *value;
+	char *build;		/* Build buffer for prepare writes */
+	u16_t len;
+};
+
 static char peer_ipv6[PEER_IPV6_LEN];	// Peer's Ipv6
+static char build_peer_ipv6[PEER_IPV6_LEN];
+static char transport[TRANSPORT_LEN];	// Transport name, e.g. "tcp"
+static char build_transport[TRANSPORT_LEN];
+static char peer_list[PEER_LIST_LEN];	// Peers, e.g. "0@fd00::1,1@fd00::2"
+static char build_peer_list[PEER_LIST_LEN];
+
+static struct config_value peer_ipv6_value = {
+	.key = STORAGE_PEER_IPV6,
+	.value = peer_ipv6,
+	.build = build_peer_ipv6,
+	.len = PEER_IPV6_LEN,
+};
+
+static struct config_value transport_value = {
+	.key = STORAGE_TRANSPORT,
+	.value = transport,
+	.build = build_transport,
+	.len = TRANSPORT_LEN,
+};
+
+static struct config_value peer_list_value = {
+	.key = STORAGE_PEER_LIST,
+	.value = peer_list,
+	.build = build_peer_list,
+	.len = PEER_LIST_LEN,
+};
 
 /* Custom Service Variables */
 static struct bt_uuid_128 config_service_uuid = BT_UUID_INIT_128(
@@ -29,49 +66,54 @@ static struct bt_uuid_128 config_service_uuid = BT_UUID_INIT_128(
 static const struct bt_uuid_128 peer_ipv6_uuid = BT_UUID_INIT_128(
 	0x71, 0x14, 0x1c, 0xbe, 0xdd, 0xe6, 0x5a, 0xb3,
 	0x8b, 0x49, 0xb4, 0x5d, 0x83, 0x11, 0x60, 0x49);
+static const struct bt_uuid_128 transport_uuid = BT_UUID_INIT_128(
+	0x72, 0x14, 0x1c, 0xbe, 0xdd, 0xe6, 0x5a, 0xb3,
+	0x8b, 0x49, 0xb4, 0x5d, 0x83, 0x11, 0x60, 0x49);
+static const struct bt_uuid_128 peer_list_uuid = BT_UUID_INIT_128(
+	0x73, 0x14, 0x1c, 0xbe, 0xdd, 0xe6, 0x5a, 0xb3,
+	0x8b, 0x49, 0xb4, 0x5d, 0x83, 0x11, 0x60, 0x49);
 
 /* Read characteristic generic function */
-static ssize_t read_ipv6(struct bt_conn *conn, const struct bt_gatt_attr *attr,
-			 void *buf, u16_t len, u16_t offset)
+static ssize_t read_value(struct bt_conn *conn, const struct bt_gatt_attr *attr,
+			  void *buf, u16_t len, u16_t offset)
 {
-	char *value = attr->user_data;
-	u16_t max_len;
+	struct config_value *config = attr->user_data;
 	int rc;
 
-	rc = storage_read(STORAGE_PEER_IPV6, peer_ipv6, sizeof(peer_ipv6));
-	if (rc != sizeof(peer_ipv6))
+	rc = storage_read(config->key, config->value, config->len);
+	if (rc != config->len)
 		return BT_GATT_ERR(BT_ATT_ERR_NOT_SUPPORTED);
 
-	max_len = strlen(peer_ipv6);
-	return bt_gatt_attr_read(conn, attr, buf, len, offset, value, max_len);
+	return bt_gatt_attr_read(conn, attr, buf, len, offset, config->value,
+				 strnlen(config->value, config->len));
 }
 
-/* Write characteristic callback function */
-static ssize_t write_ipv6(struct bt_conn *conn, const struct bt_gatt_attr *attr,
-			 const void *buf, u16_t len, u16_t offset, u8_t flags)
+/* Write characteristic generic function */
+static ssize_t write_value(struct bt_conn *conn,
+			   const struct bt_gatt_attr *attr,
+			   const void *buf, u16_t len, u16_t offset,
+			   u8_t flags)
 {
-	u8_t *value = attr->user_data;
-	u16_t max_len = sizeof(peer_ipv6) - 1;	// Last byte preserved for '\0'
-	static char build_peer_ipv6[PEER_IPV6_LEN]; // Peer's Ipv6 build buffer
+	struct config_value *config = attr->user_data;
+	u16_t max_len = config->len - 1;	// Last byte preserved for '\0'
 	int rc;
 
 	if (offset + len > max_len)
 		return BT_GATT_ERR(BT_ATT_ERR_INVALID_OFFSET);
 
 	if (offset == 0)
-		memset(build_peer_ipv6, 0, max_len);
+		memset(config->build, 0, config->len);
 
-	memcpy(build_peer_ipv6 + offset, buf, len);
+	memcpy(config->build + offset, buf, len);
 
 	/* Check for prepare write flag */
 	if (flags & BT_GATT_WRITE_FLAG_PREPARE)
 		return 0;
 
-	/* Store value at "peer_ipv6", pointed as "value" */
-	memcpy(value, build_peer_ipv6, PEER_IPV6_LEN);
-	rc = storage_write(STORAGE_PEER_IPV6, build_peer_ipv6, PEER_IPV6_LEN);
+	memcpy(config->value, config->build, config->len);
+	rc = storage_write(config->key, config->build, config->len);
 
-	if (rc != PEER_IPV6_LEN)
+	if (rc != config->len)
 		return BT_GATT_ERR(BT_ATT_ERR_NOT_SUPPORTED);
 
 	return len;
@@ -86,7 +128,21 @@ static struct bt_gatt_attr config_gatt_attrs[] = {
 			       BT_GATT_PERM_READ |
 			       BT_GATT_PERM_WRITE |
 			       BT_GATT_PERM_PREPARE_WRITE,
-			       read_ipv6, write_ipv6, peer_ipv6),
+			       read_value, write_value, &peer_ipv6_value),
+	/* Transport used by the thing: "tcp", "udp", "coap" or "mqttsn" */
+	BT_GATT_CHARACTERISTIC(&transport_uuid.uuid,
+			       BT_GATT_CHRC_READ | BT_GATT_CHRC_WRITE,
+			       BT_GATT_PERM_READ |
+			       BT_GATT_PERM_WRITE |
+			       BT_GATT_PERM_PREPARE_WRITE,
+			       read_value, write_value, &transport_value),
+	/* Gateways as "prio@addr" entries separated by ',': lower prio first */
+	BT_GATT_CHARACTERISTIC(&peer_list_uuid.uuid,
+			       BT_GATT_CHRC_READ | BT_GATT_CHRC_WRITE,
+			       BT_GATT_PERM_READ |
+			       BT_GATT_PERM_WRITE |
+			       BT_GATT_PERM_PREPARE_WRITE,
+			       read_value, write_value, &peer_list_value),
 };
 
 static struct bt_gatt_service config_svc = BT_GATT_SERVICE(config_gatt_attrs);